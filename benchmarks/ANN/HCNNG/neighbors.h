@@ -34,6 +34,7 @@
 #include "../utils/parse_results.h"
 #include "../utils/check_nn_recall.h"
 #include "hcnng_index.h"
+#include "../utils/indexFile.h"
 
 extern bool report_stats;
 template<typename T>
@@ -57,6 +58,7 @@ void ANN(parlay::sequence<Tvec_point<T>*> &v, int k, int mstDeg,
   auto [avg_deg, max_deg] = graph_stats(v);
   Graph G(name, params, v.size(), avg_deg, max_deg, idx_time);
   G.print();
+  set_index_info(name, params, {}, idx_time, mips);
   search_and_parse(G, v, q, groundTruth, res_file, mips);
 
 }
@@ -72,11 +74,20 @@ void ANN(parlay::sequence<Tvec_point<T>*> v, int MSTdeg, int num_clusters, doubl
     findex I(MSTdeg, d, mips);
     if(!graph_built){
       I.build_index(v, num_clusters, cluster_size);
-      t.next("Built index");
     }
+    set_index_info("HCNNG", "Trees = " + std::to_string(num_clusters), {}, t.total_time(), mips);
+    if(!graph_built) t.next("Built index");
     if(report_stats){
       graph_stats(v);
       t.next("stats");
     }
   };
-}
\ No newline at end of file
+}
+
+template<typename T>
+void ANN_stream(parlay::sequence<Tvec_point<T>*> &v, int k, int maxDeg, int beamSize, int beamSizeQ,
+	double alpha, parlay::sequence<Tvec_point<T>*> &q, size_t window, size_t step,
+	double consolidate, bool mips) {
+  std::cout << "Error: HCNNG does not support updates, the stream mode needs vamana" << std::endl;
+  abort();
+}
@@ -33,6 +33,7 @@
 #include "../utils/stats.h"
 #include "../utils/parse_results.h"
 #include "../utils/check_nn_recall.h"
+#include "../utils/indexFile.h"
 
 extern bool report_stats;
 
@@ -60,6 +61,7 @@ void ANN(parlay::sequence<Tvec_point<T>*> &v, int k, int K, int cluster_size, in
     auto [avg_deg, max_deg] = graph_stats(v);
     Graph G(name, params, v.size(), avg_deg, max_deg, idx_time);
     G.print();
+    set_index_info(name, params, {}, idx_time, mips);
     search_and_parse(G, v, q, groundTruth, res_file, mips);
   };
 }
@@ -74,11 +76,20 @@ void ANN(parlay::sequence<Tvec_point<T>*> v, int K, int cluster_size, double num
     if(!graph_built){
        findex I(K, d, .05, mips);
       I.build_index(v, cluster_size, (int) num_clusters, alpha);
-      t.next("Built index");
     }
+    set_index_info("pyNNDescent", "K = " + std::to_string(K), {}, t.total_time(), mips);
+    if(!graph_built) t.next("Built index");
     if(report_stats){
       graph_stats(v);
       t.next("stats");
     }
   };
 }
+
+template<typename T>
+void ANN_stream(parlay::sequence<Tvec_point<T>*> &v, int k, int maxDeg, int beamSize, int beamSizeQ,
+	double alpha, parlay::sequence<Tvec_point<T>*> &q, size_t window, size_t step,
+	double consolidate, bool mips) {
+  std::cout << "Error: pyNNDescent does not support updates, the stream mode needs vamana" << std::endl;
+  abort();
+}
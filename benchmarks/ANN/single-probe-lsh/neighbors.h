@@ -43,13 +43,14 @@ extern bool report_stats;
 namespace recall {
 
 template <typename T, typename I>
-void searchAll(I& index, parlay::sequence<Tvec_point<T>*>& q, int k, unsigned dim,
+void searchAll(I& index, parlay::sequence<Tvec_point<T>*>& q, int k, unsigned dim, int probes,
   parlay::sequence<uint32_t>& query_result_size,
   parlay::sequence<uint32_t>& query_result_ids,
   parlay::sequence<float>&    query_result_dists,
   parlay::sequence<size_t>&   query_result_comps) {
 
   grann::Parameters search_params;
+  search_params.Set<uint32_t>("num_probes", probes);
 
   std::cout << "Running searches" << std::endl;
 	parlay::parallel_for(0, q.size(), [&] (size_t i) {
@@ -69,7 +70,8 @@ lsh_result checkRecall(
         parlay::sequence<Tvec_point<T>*> &q,
         parlay::sequence<ivec_point> groundTruth,
         int k,
-        unsigned d) {
+        unsigned d,
+        int probes = 1) {
 
   parlay::sequence<uint32_t>    query_result_size(q.size());
   parlay::sequence<uint32_t> query_result_ids(q.size() * k);
@@ -80,9 +82,9 @@ lsh_result checkRecall(
   int r = 10;
   float query_time;
 
-  searchAll(index, q, k, d, query_result_size, query_result_ids, query_result_dists, query_result_comps);
+  searchAll(index, q, k, d, probes, query_result_size, query_result_ids, query_result_dists, query_result_comps);
   t.next_time();
-  searchAll(index, q, k, d, query_result_size, query_result_ids, query_result_dists, query_result_comps);
+  searchAll(index, q, k, d, probes, query_result_size, query_result_ids, query_result_dists, query_result_comps);
   query_time = t.next_time();
 
   for (size_t i=0; i<q.size(); ++i) {
@@ -133,9 +135,8 @@ lsh_result checkRecall(
   }
   float QPS = q.size()/query_time;
   auto stats = distance_stats(q);
-  std::cout << "recall = " << recall << " QPS = " << QPS << " k = " << k << std::endl;
-  int num_tables=0; //dummy param, we'll add varying tables later
-  lsh_result N(recall, stats, QPS, k, num_tables, q.size());
+  std::cout << "recall = " << recall << " QPS = " << QPS << " k = " << k << " probes = " << probes << std::endl;
+  lsh_result N(recall, stats, QPS, k, index.tables_used(), q.size(), probes);
   return N;
 }
 
@@ -146,11 +147,11 @@ void write_to_csv(std::string csv_filename, parlay::sequence<float> buckets,
   csv << L.name << L.params << L.size << L.time << endrow;
   csv << endrow;
   csv << "Num queries" << "Target recall" << "Actual recall" << "QPS" << "Average Cmps" <<
-    "Tail Cmps" << "k" << "Tables" << endrow;
+    "Tail Cmps" << "k" << "Tables" << "Probes" << endrow;
   for(int i=0; i<results.size(); i++){
     lsh_result N = results[i];
     csv << N.num_queries << buckets[i] << N.recall << N.QPS << N.avg_cmps 
-    << N.tail_cmps << N.k << N.num_tables << endrow;
+    << N.tail_cmps << N.k << N.num_tables << N.probes << endrow;
   }
   csv << endrow;
   csv << endrow;
@@ -166,6 +167,11 @@ void search_and_parse(I& index, parlay::sequence<Tvec_point<T>*> &v, parlay::seq
 
     for (int kk : allk)
       results.push_back(checkRecall(index, q, groundTruth, kk, d));
+    // multi-probe: more buckets per table instead of more tables
+    std::vector<int> allprobes = {2, 4, 8, 16, 32, 64, 128};
+    for (int kk : {10, 20})
+      for (int probes : allprobes)
+        results.push_back(checkRecall(index, q, groundTruth, kk, d, probes));
 
     parlay::sequence<float> buckets = {.1, .15, .2, .25, .3, .35, .4, .45, .5, .55, .6, .65, .7, .73, .75, .77, .8, .83, .85, .87, .9, .93, .95, .97, .99, .995, .999};
     auto [res, ret_buckets] = parse_result(results, buckets);
@@ -198,6 +204,7 @@ void ANN(parlay::sequence<Tvec_point<T>*> &v, int k, int maxDeg,
 
   LSH L(name, params_string, v.size(), idx_time);
   L.print();
+  std::cout << "Tables use " << I.bytes() << " bytes" << std::endl;
 
   uint32_t dim = q[0]->coordinates.size();
 
@@ -209,3 +216,11 @@ template<typename T>
 void ANN(parlay::sequence<Tvec_point<T>*> v, int maxDeg, int beamSize, double alpha, double dummy, bool graph_built, bool mips) {
 }
 
+
+template<typename T>
+void ANN_stream(parlay::sequence<Tvec_point<T>*> &v, int k, int maxDeg, int beamSize, int beamSizeQ,
+	double alpha, parlay::sequence<Tvec_point<T>*> &q, size_t window, size_t step,
+	double consolidate, bool mips) {
+  std::cout << "Error: Single-Probe-LSH does not support updates, the stream mode needs vamana" << std::endl;
+  abort();
+}
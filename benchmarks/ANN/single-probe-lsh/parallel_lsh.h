@@ -3,6 +3,8 @@
 #include <algorithm>
 #include <bitset>
 #include <map>
+#include <type_traits>
+#include <vector>
 
 #include "parameters.h"
 
@@ -25,16 +27,24 @@ namespace grann {
       _mm_prefetch((const char*) vec + d, _MM_HINT_T1);
   }
 
+  // The buckets of a table are stored flat: the ids of all points,
+  // grouped by bucket, in one sequence, and a directory, addressed by a
+  // hash of the bucket id with linear probing, giving the range of each
+  // bucket in it.
   class HashTable {
    public:
+    struct bucket_range {
+      uint64_t key;
+      uint32_t start;
+      uint32_t len;  // 0 for an empty slot
+    };
+
     HashTable(uint32_t table_s, uint32_t vector_d) {
       if (table_s > BITSET_MAX) {
         perror("Input table size is too large");
         exit(1);
       }
 
-      random_hps.reserve(table_s);
-
       vector_dim = vector_d;
       table_size = table_s;
     }
@@ -44,59 +54,127 @@ namespace grann {
       std::random_device              r;
       std::default_random_engine      rng{r()};
       std::normal_distribution<float> gaussian_dist;
-      for (size_t i = 0; i < table_size; i++) {
-        std::vector<float> random_hp;
-        random_hp.reserve(vector_dim);
-        for (size_t j = 0; j < vector_dim; j++) {
-          float add = gaussian_dist(rng);
-          random_hp.push_back(add);
-        }
-        add_hp(random_hp);
-      }
+      hps = parlay::sequence<float>(table_size * vector_dim);
+      for (size_t j = 0; j < hps.size(); j++) hps[j] = gaussian_dist(rng);
     }
 
-    parlay::sequence<uint32_t>& get_bucket(bitstring bucket_id) {
-      auto seq = parlay::delayed_seq<size_t>(buckets.size(), [&] (size_t i) { return buckets[i].first; });
-      size_t index = parlay::internal::binary_search(seq, bucket_id.to_ulong(), std::less<size_t>());
-      assert(bucket_id.to_ulong() == buckets[index].first);
-      return buckets[index].second;
+    // the points in the bucket, empty if there are none
+    parlay::slice<const uint32_t*, const uint32_t*> get_bucket(bitstring bucket_id) const {
+      uint64_t key = bucket_id.to_ullong();
+      for (size_t s = parlay::hash64_2(key) & mask;; s = (s + 1) & mask) {
+        const bucket_range& b = directory[s];
+        if (b.len == 0) return parlay::make_slice(ids.begin(), ids.begin());
+        if (b.key == key) return parlay::make_slice(ids.begin() + b.start, ids.begin() + b.start + b.len);
+      }
     }
 
+    // the inner products of the input with the hyperplanes, computed
+    // with the SIMD kernels used for distances
     template<typename T>
-    bitstring get_hash(const T *input_vector) {
-      bitstring input_bits;
-      for (size_t i = 0; i < table_size; i++) {
-        // float dot_p = std::inner_product(random_hps[i].begin(),
-        // random_hps[i].end(), input_vector, 0.0);
-        float dot_p = 0.0;
-        for (size_t j = 0; j < vector_dim; j++) {
-          float x = random_hps[i][j] * input_vector[j];
-          dot_p += x;
-        }
-
-        if (dot_p > 0)
-          input_bits[i] = 1;
-        else
-          input_bits[i] = 0;
+    void project(const T *input_vector, float *out) const {
+      static thread_local std::vector<float> x;
+      static thread_local std::vector<const float*> rows;
+      const float* xf;
+      if constexpr (std::is_same_v<T, float>) xf = input_vector;
+      else {
+        x.resize(vector_dim);
+        for (size_t j = 0; j < vector_dim; j++) x[j] = (float) input_vector[j];
+        xf = x.data();
       }
+      rows.resize(table_size);
+      for (size_t i = 0; i < table_size; i++) rows[i] = hps.begin() + i * vector_dim;
+      ann_simd::active<float>.ip_batch(xf, rows.data(), table_size, vector_dim, out);
+    }
+
+    bitstring hash_of(const float *proj) const {
+      bitstring input_bits;
+      for (size_t i = 0; i < table_size; i++) input_bits[i] = (proj[i] > 0);
       return input_bits;
     }
 
-  void add_hp(std::vector<float> hp) {
-    random_hps.push_back(hp);
-  }
+    template<typename T>
+    bitstring get_hash(const T *input_vector) const {
+      float proj[BITSET_MAX];
+      project(input_vector, proj);
+      return hash_of(proj);
+    }
 
-  void set_buckets(parlay::sequence<std::pair<size_t, parlay::sequence<uint32_t>>>&& B) {
-    buckets = std::move(B);
-  }
+    // groups the points by the hash of each, given as (hash, id) pairs
+    void set_buckets(parlay::sequence<std::pair<size_t, uint32_t>>& hash_ids) {
+      auto sorted = parlay::stable_sort(hash_ids, [] (auto a, auto b) {return a.first < b.first;});
+      ids = parlay::map(sorted, [] (auto p) {return p.second;});
+      auto starts = parlay::filter(parlay::iota<uint32_t>(sorted.size()), [&] (uint32_t i) {
+        return i == 0 || sorted[i].first != sorted[i-1].first;});
+      size_t slots = 2;
+      while (slots < 2 * starts.size()) slots *= 2;
+      mask = slots - 1;
+      directory = parlay::sequence<bucket_range>(slots, bucket_range{0, 0, 0});
+      for (size_t b = 0; b < starts.size(); b++) {
+        uint32_t end = (b + 1 < starts.size()) ? starts[b+1] : sorted.size();
+        uint64_t key = sorted[starts[b]].first;
+        size_t s = parlay::hash64_2(key) & mask;
+        while (directory[s].len != 0) s = (s + 1) & mask;
+        directory[s] = bucket_range{key, starts[b], end - starts[b]};
+      }
+      num_buckets = starts.size();
+    }
+
+    size_t buckets() const {return num_buckets;}
+    size_t bytes() const {
+      return ids.size() * sizeof(uint32_t) + directory.size() * sizeof(bucket_range) + hps.size() * sizeof(float);
+    }
 
    protected:
     uint32_t vector_dim;  // dimension of points stored/each hp vector
     uint32_t table_size;  // number of hyperplanes
-    std::vector<std::vector<float>>     random_hps;
-    parlay::sequence<std::pair<size_t, parlay::sequence<uint32_t>>> buckets;
+    parlay::sequence<float> hps;  // the hyperplanes, one after the other
+    parlay::sequence<uint32_t> ids;
+    parlay::sequence<bucket_range> directory;
+    size_t mask = 0;
+    size_t num_buckets = 0;
   };
 
+  // The buckets to probe in a table, as masks of the hash bits to flip,
+  // in order of increasing sum of the squared projections on the flipped
+  // hyperplanes (the query directed probing of Lv et al.), starting with
+  // the empty mask for the query's own bucket.  Sets of positions in the
+  // order of increasing projection are generated from {0} by shifting
+  // the largest position up by one or adding the next one, which visits
+  // each set once and never produces a set before a subset of it.
+  inline void probe_sequence(const float *proj, uint32_t bits, uint32_t probes,
+                             std::vector<uint64_t> &masks) {
+    masks.clear();
+    masks.push_back(0);
+    if (probes <= 1 || bits == 0) return;
+    uint32_t order[BITSET_MAX];
+    float z[BITSET_MAX];
+    for (uint32_t i = 0; i < bits; i++) order[i] = i;
+    std::sort(order, order + bits, [&] (uint32_t a, uint32_t b) {
+      return proj[a] * proj[a] < proj[b] * proj[b];});
+    for (uint32_t i = 0; i < bits; i++) z[i] = proj[order[i]] * proj[order[i]];
+    struct probe_set {float score; uint64_t positions; uint32_t last;};
+    auto greater = [] (const probe_set& a, const probe_set& b) {return a.score > b.score;};
+    static thread_local std::vector<probe_set> heap;
+    heap.clear();
+    heap.push_back(probe_set{z[0], 1, 0});
+    while (masks.size() < probes && !heap.empty()) {
+      std::pop_heap(heap.begin(), heap.end(), greater);
+      probe_set a = heap.back();
+      heap.pop_back();
+      uint64_t m = 0;
+      for (uint64_t p = a.positions; p != 0; p &= p - 1) m |= uint64_t(1) << order[__builtin_ctzll(p)];
+      masks.push_back(m);
+      uint32_t next = a.last + 1;
+      if (next < bits) {
+        heap.push_back(probe_set{a.score - z[a.last] + z[next],
+              (a.positions ^ (uint64_t(1) << a.last)) | (uint64_t(1) << next), next});
+        std::push_heap(heap.begin(), heap.end(), greater);
+        heap.push_back(probe_set{a.score + z[next], a.positions | (uint64_t(1) << next), next});
+        std::push_heap(heap.begin(), heap.end(), greater);
+      }
+    }
+  }
+
 
   // Simple Neighbor with a flag, for remembering whether we already explored
   // out of a vertex or not.
@@ -194,37 +272,50 @@ namespace grann {
         auto hash_ids = parlay::sequence<std::pair<size_t, uint32_t>>::from_function(v.size(), [&] (size_t i) {
           const T* cur_vec = v[i]->coordinates.begin();
           bitstring cur_vec_hash = table.get_hash(cur_vec);
-          return std::make_pair(cur_vec_hash.to_ulong(), i);
+          return std::make_pair((size_t) cur_vec_hash.to_ullong(), (uint32_t) i);
         });
-        auto buckets = parlay::group_by_key_ordered(hash_ids);
-
-        table.set_buckets(std::move(buckets));
+        table.set_buckets(hash_ids);
 
         ++j;
       }
     }
 
-  // Returns the number of neighbors retrieved.
+    uint32_t tables_used() const {return num_tables;}
+
+    size_t bytes() const {
+      size_t b = 0;
+      for (auto &table : tables) b += table.bytes();
+      return b;
+    }
+
+  // Returns the number of neighbors retrieved.  The candidates are the
+  // points in the first num_probes buckets of the probe sequence of each
+  // table (by default 1, the query's own bucket).
   uint32_t search(T *query, uint32_t dim, uint32_t res_count,
                            const Parameters &search_params, uint32_t *indices,
                            float *distances, size_t* comps) {
-    std::vector<uint32_t> candidates;
+    uint32_t probes = search_params.Get<uint32_t>("num_probes", 1);
+    static thread_local std::vector<uint32_t> candidates;
+    static thread_local std::vector<uint64_t> masks;
+    candidates.clear();
     for (auto &table : tables) {
-      bitstring         query_hash = table.get_hash(query);
-      parlay::sequence<uint32_t>& curr_bucket = table.get_bucket(query_hash);
-      candidates.insert(candidates.end(), curr_bucket.begin(),
-                        curr_bucket.end());
+      float proj[BITSET_MAX];
+      table.project(query, proj);
+      bitstring query_hash = table.hash_of(proj);
+      probe_sequence(proj, table_size, probes, masks);
+      for (uint64_t m : masks) {
+        auto curr_bucket = table.get_bucket(query_hash ^ bitstring(m));
+        candidates.insert(candidates.end(), curr_bucket.begin(), curr_bucket.end());
+      }
     }
 
     std::vector<Neighbor> best_candidates(res_count + 1);
     uint32_t                  curr_size = 0;
     uint32_t                  max_size = res_count;
     uint32_t                  cmps = 0;
-    std::set<uint32_t>  inserted;
 
     process_candidates_into_best_candidates_pool(
-        query, dim, candidates, best_candidates, max_size, curr_size, inserted,
-        cmps);
+        query, dim, candidates, best_candidates, max_size, curr_size, cmps);
     comps[0]=(size_t) cmps;
 
     res_count = curr_size < res_count ? curr_size : res_count;
@@ -236,23 +327,29 @@ namespace grann {
       }
     }
 
-    // TODO
-    *comps = 0;
-
     return res_count;
   }
 
+  // candidates found in several buckets are only compared once, which is
+  // tracked by tagging each point with the number of the search of the
+  // calling worker that saw it last
   uint32_t process_candidates_into_best_candidates_pool(
       T* &node_coords, uint32_t dim, std::vector<uint32_t> &cand_list,
       std::vector<Neighbor> &top_L_candidates, const uint32_t maxListSize,
-      uint32_t &curListSize, std::set<uint32_t> &already_inserted,
-      uint32_t &total_comparisons) {
+      uint32_t &curListSize, uint32_t &total_comparisons) {
+    static thread_local std::vector<uint32_t> seen;
+    static thread_local uint32_t epoch = 0;
+    if (seen.size() < v.size()) seen.assign(v.size(), 0);
+    if (++epoch == 0) {
+      std::fill(seen.begin(), seen.end(), 0);
+      epoch = 1;
+    }
     uint32_t best_inserted_position = maxListSize;
 
     for (unsigned m = 0; m < cand_list.size(); ++m) {
       unsigned id = cand_list[m];
-      if (already_inserted.find(id) == already_inserted.end()) {
-        already_inserted.insert(id);
+      if (seen[id] != epoch) {
+        seen[id] = epoch;
 
         if ((m + 1) < cand_list.size()) {
           auto nextn = cand_list[m + 1];
@@ -34,7 +34,7 @@ class Parameters {
   }
 
   template<typename ParamType>
-  inline ParamType Get(const std::string &name, const ParamType &default_value) {
+  inline ParamType Get(const std::string &name, const ParamType &default_value) const {
     try {
       return Get<ParamType>(name);
     } catch (std::invalid_argument e) {
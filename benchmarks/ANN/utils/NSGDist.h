@@ -10,6 +10,8 @@
 #include <algorithm>
 #include <type_traits>
 #include <math.h>
+#include <string>
+#include <cstdlib>
 #include "parlay/parallel.h"
 #include "parlay/primitives.h"
 #include "common/geometry.h"
@@ -335,22 +337,309 @@ namespace efanna2e{
   };
 }
 
-float mips_distance(uint8_t *p, uint8_t *q, unsigned d){
-  int result = 0;
-  for(int i=0; i<d; i++){
-    result += ((int32_t) q[i]) *
-                  ((int32_t) p[i]);
+// *************************************************************
+//  SIMD DISTANCE KERNELS
+// *************************************************************
+
+// Squared L2 and inner product kernels for the float, uint8 and int8
+// points used by neighborsTime, compiled for AVX2, AVX-512 and (for the
+// integer types) AVX-512 VNNI, and chosen at startup according to what
+// the processor supports.  The choice can be overridden by setting the
+// environment variable PBBS_ANN_SIMD to scalar, avx2, avx512 or vnni.
+// The batched kernels compare one query against several candidates at
+// a time, so the query is loaded once per block, and prefetch the
+// candidates of the next block.  Integer types are widened to 16 bits
+// and accumulated exactly in 32 bit lanes.
+namespace ann_simd {
+
+  template<typename T>
+  struct kernels {
+    using dist_f = float (*)(T const*, T const*, unsigned);
+    using batch_f = void (*)(T const*, T const* const*, size_t, unsigned, float*);
+    dist_f l2, ip;
+    batch_f l2_batch, ip_batch;
+    char const* isa;
+  };
+
+  template<typename T>
+  inline void prefetch_point(T const* p, unsigned d) {
+    char const* c = (char const*) p;
+    for (size_t i = 0; i < d * sizeof(T); i += 64)
+      _mm_prefetch(c + i, _MM_HINT_T0);
+  }
+
+  namespace scalar {
+    template<typename T, bool IP>
+    float dist(T const* a, T const* b, unsigned d) {
+      using acc = std::conditional_t<std::is_floating_point_v<T>, float, int32_t>;
+      acc r = 0;
+      for (unsigned i = 0; i < d; i++) {
+	if constexpr (IP) r += (acc) a[i] * (acc) b[i];
+	else {acc x = (acc) a[i] - (acc) b[i]; r += x * x;}
+      }
+      return (float) r;
+    }
+
+    template<typename T, bool IP>
+    void batch(T const* q, T const* const* c, size_t m, unsigned d, float* out) {
+      for (size_t j = 0; j < m; j++) out[j] = dist<T,IP>(q, c[j], d);
+    }
+  }
+
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+  namespace avx2 {
+    inline float hsum(__m256 s) {
+      __m128 x = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+      x = _mm_add_ps(x, _mm_movehl_ps(x, x));
+      return _mm_cvtss_f32(_mm_add_ss(x, _mm_movehdup_ps(x)));
+    }
+
+    inline float hsum(__m256i s) {
+      __m128i x = _mm_add_epi32(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s, 1));
+      x = _mm_add_epi32(x, _mm_shuffle_epi32(x, 0x4e));
+      return (float) _mm_cvtsi128_si32(_mm_add_epi32(x, _mm_shuffle_epi32(x, 0xb1)));
+    }
+
+    struct f32 {
+      using T = float; using vec = __m256;
+      static constexpr unsigned W = 8;
+      static vec zero() {return _mm256_setzero_ps();}
+      static vec load(T const* p) {return _mm256_loadu_ps(p);}
+      static vec l2(vec s, vec a, vec b) {vec x = _mm256_sub_ps(a, b); return _mm256_fmadd_ps(x, x, s);}
+      static vec ip(vec s, vec a, vec b) {return _mm256_fmadd_ps(a, b, s);}
+    };
+
+    template<typename E>
+    struct int8_type {
+      using T = E; using vec = __m256i;
+      static constexpr unsigned W = 16;
+      static vec zero() {return _mm256_setzero_si256();}
+      static vec load(T const* p) {
+	__m128i x = _mm_loadu_si128((__m128i const*) p);
+	if constexpr (std::is_signed_v<E>) return _mm256_cvtepi8_epi16(x);
+	else return _mm256_cvtepu8_epi16(x);}
+      static vec l2(vec s, vec a, vec b) {
+	vec x = _mm256_sub_epi16(a, b); return _mm256_add_epi32(s, _mm256_madd_epi16(x, x));}
+      static vec ip(vec s, vec a, vec b) {return _mm256_add_epi32(s, _mm256_madd_epi16(a, b));}
+    };
+
+    // distances from q to each of the B points in c
+    template<class K, bool IP, int B>
+    inline void block(typename K::T const* q, typename K::T const* const* c, unsigned d, float* out) {
+      typename K::vec s[B];
+      for (int j = 0; j < B; j++) s[j] = K::zero();
+      unsigned i = 0;
+      for (; i + K::W <= d; i += K::W) {
+	auto x = K::load(q + i);
+	for (int j = 0; j < B; j++)
+	  s[j] = IP ? K::ip(s[j], x, K::load(c[j] + i)) : K::l2(s[j], x, K::load(c[j] + i));
+      }
+      for (int j = 0; j < B; j++)
+	out[j] = hsum(s[j]) + scalar::dist<typename K::T,IP>(q + i, c[j] + i, d - i);
+    }
+
+    template<class K, bool IP>
+    float dist(typename K::T const* a, typename K::T const* b, unsigned d) {
+      float r; block<K,IP,1>(a, &b, d, &r); return r;}
+
+    template<class K, bool IP>
+    void batch(typename K::T const* q, typename K::T const* const* c, size_t m, unsigned d, float* out) {
+      size_t j = 0;
+      for (; j + 4 <= m; j += 4) {
+	for (size_t l = j + 4; l < std::min(m, j + 8); l++) prefetch_point(c[l], d);
+	block<K,IP,4>(q, c + j, d, out + j);
+      }
+      for (; j < m; j++) block<K,IP,1>(q, c + j, d, out + j);
+    }
+  }
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2,fma,avx512f,avx512bw,avx512vl")
+  namespace avx512 {
+    struct f32 {
+      using T = float; using vec = __m512;
+      static constexpr unsigned W = 16;
+      static vec zero() {return _mm512_setzero_ps();}
+      static vec load(T const* p) {return _mm512_loadu_ps(p);}
+      static vec load_tail(T const* p, unsigned n) {
+	return _mm512_maskz_loadu_ps((__mmask16) ((1u << n) - 1), p);}
+      static vec l2(vec s, vec a, vec b) {vec x = _mm512_sub_ps(a, b); return _mm512_fmadd_ps(x, x, s);}
+      static vec ip(vec s, vec a, vec b) {return _mm512_fmadd_ps(a, b, s);}
+      static float hsum(vec s) {return _mm512_reduce_add_ps(s);}
+    };
+
+    template<typename E>
+    struct int8_type {
+      using T = E; using vec = __m512i;
+      static constexpr unsigned W = 32;
+      static vec zero() {return _mm512_setzero_si512();}
+      static vec widen(__m256i x) {
+	if constexpr (std::is_signed_v<E>) return _mm512_cvtepi8_epi16(x);
+	else return _mm512_cvtepu8_epi16(x);}
+      static vec load(T const* p) {return widen(_mm256_loadu_si256((__m256i const*) p));}
+      static vec load_tail(T const* p, unsigned n) {
+	return widen(_mm256_maskz_loadu_epi8((__mmask32) ((1ul << n) - 1), p));}
+      static vec l2(vec s, vec a, vec b) {
+	vec x = _mm512_sub_epi16(a, b); return _mm512_add_epi32(s, _mm512_madd_epi16(x, x));}
+      static vec ip(vec s, vec a, vec b) {return _mm512_add_epi32(s, _mm512_madd_epi16(a, b));}
+      static float hsum(vec s) {return (float) _mm512_reduce_add_epi32(s);}
+    };
+
+    // distances from q to each of the B points in c, the tail is
+    // handled with masked loads
+    template<class K, bool IP, int B>
+    inline void block(typename K::T const* q, typename K::T const* const* c, unsigned d, float* out) {
+      typename K::vec s[B];
+      for (int j = 0; j < B; j++) s[j] = K::zero();
+      unsigned i = 0;
+      for (; i + K::W <= d; i += K::W) {
+	auto x = K::load(q + i);
+	for (int j = 0; j < B; j++)
+	  s[j] = IP ? K::ip(s[j], x, K::load(c[j] + i)) : K::l2(s[j], x, K::load(c[j] + i));
+      }
+      if (i < d) {
+	auto x = K::load_tail(q + i, d - i);
+	for (int j = 0; j < B; j++)
+	  s[j] = (IP ? K::ip(s[j], x, K::load_tail(c[j] + i, d - i))
+		  : K::l2(s[j], x, K::load_tail(c[j] + i, d - i)));
+      }
+      for (int j = 0; j < B; j++) out[j] = K::hsum(s[j]);
+    }
+
+    template<class K, bool IP>
+    float dist(typename K::T const* a, typename K::T const* b, unsigned d) {
+      float r; block<K,IP,1>(a, &b, d, &r); return r;}
+
+    template<class K, bool IP>
+    void batch(typename K::T const* q, typename K::T const* const* c, size_t m, unsigned d, float* out) {
+      size_t j = 0;
+      for (; j + 4 <= m; j += 4) {
+	for (size_t l = j + 4; l < std::min(m, j + 8); l++) prefetch_point(c[l], d);
+	block<K,IP,4>(q, c + j, d, out + j);
+      }
+      for (; j < m; j++) block<K,IP,1>(q, c + j, d, out + j);
+    }
   }
-  return -((float) result);
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2,fma,avx512f,avx512bw,avx512vl,avx512vnni")
+  namespace vnni {
+    // as avx512::int8_type but fusing the multiply and accumulate
+    template<typename E>
+    struct int8_type : avx512::int8_type<E> {
+      using vec = __m512i;
+      static vec l2(vec s, vec a, vec b) {
+	vec x = _mm512_sub_epi16(a, b); return _mm512_dpwssd_epi32(s, x, x);}
+      static vec ip(vec s, vec a, vec b) {return _mm512_dpwssd_epi32(s, a, b);}
+    };
+
+    // the same as avx512::block, but it has to be compiled with vnni
+    // enabled for the kernels to be inlined
+    template<class K, bool IP, int B>
+    inline void block(typename K::T const* q, typename K::T const* const* c, unsigned d, float* out) {
+      typename K::vec s[B];
+      for (int j = 0; j < B; j++) s[j] = K::zero();
+      unsigned i = 0;
+      for (; i + K::W <= d; i += K::W) {
+	auto x = K::load(q + i);
+	for (int j = 0; j < B; j++)
+	  s[j] = IP ? K::ip(s[j], x, K::load(c[j] + i)) : K::l2(s[j], x, K::load(c[j] + i));
+      }
+      if (i < d) {
+	auto x = K::load_tail(q + i, d - i);
+	for (int j = 0; j < B; j++)
+	  s[j] = (IP ? K::ip(s[j], x, K::load_tail(c[j] + i, d - i))
+		  : K::l2(s[j], x, K::load_tail(c[j] + i, d - i)));
+      }
+      for (int j = 0; j < B; j++) out[j] = K::hsum(s[j]);
+    }
+
+    template<class K, bool IP>
+    float dist(typename K::T const* a, typename K::T const* b, unsigned d) {
+      float r; block<K,IP,1>(a, &b, d, &r); return r;}
+
+    template<class K, bool IP>
+    void batch(typename K::T const* q, typename K::T const* const* c, size_t m, unsigned d, float* out) {
+      size_t j = 0;
+      for (; j + 4 <= m; j += 4) {
+	for (size_t l = j + 4; l < std::min(m, j + 8); l++) prefetch_point(c[l], d);
+	block<K,IP,4>(q, c + j, d, out + j);
+      }
+      for (; j < m; j++) block<K,IP,1>(q, c + j, d, out + j);
+    }
+  }
+#pragma GCC pop_options
+
+  template<typename T>
+  kernels<T> select_kernels() {
+    __builtin_cpu_init();
+    bool has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    bool has_avx512 = (has_avx2 && __builtin_cpu_supports("avx512f") &&
+		       __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl"));
+    bool has_vnni = has_avx512 && __builtin_cpu_supports("avx512vnni");
+    char const* s = getenv("PBBS_ANN_SIMD");
+    std::string want = (s == nullptr) ? "" : s;
+    if (want == "scalar") has_avx2 = false;
+    if (want == "scalar" || want == "avx2") has_avx512 = false;
+    if (want != "" && want != "vnni") has_vnni = false;
+
+    if constexpr (std::is_same_v<T, float>) {
+      if (has_avx512) {
+	using K = avx512::f32;
+	return {avx512::dist<K,false>, avx512::dist<K,true>,
+		avx512::batch<K,false>, avx512::batch<K,true>, "avx512"};
+      } else if (has_avx2) {
+	using K = avx2::f32;
+	return {avx2::dist<K,false>, avx2::dist<K,true>,
+		avx2::batch<K,false>, avx2::batch<K,true>, "avx2"};
+      }
+    } else {
+      if (has_vnni) {
+	using K = vnni::int8_type<T>;
+	return {vnni::dist<K,false>, vnni::dist<K,true>,
+		vnni::batch<K,false>, vnni::batch<K,true>, "vnni"};
+      } else if (has_avx512) {
+	using K = avx512::int8_type<T>;
+	return {avx512::dist<K,false>, avx512::dist<K,true>,
+		avx512::batch<K,false>, avx512::batch<K,true>, "avx512"};
+      } else if (has_avx2) {
+	using K = avx2::int8_type<T>;
+	return {avx2::dist<K,false>, avx2::dist<K,true>,
+		avx2::batch<K,false>, avx2::batch<K,true>, "avx2"};
+      }
+    }
+    return {scalar::dist<T,false>, scalar::dist<T,true>,
+	    scalar::batch<T,false>, scalar::batch<T,true>, "scalar"};
+  }
+
+  // selected once at startup
+  template<typename T>
+  inline const kernels<T> active = select_kernels<T>();
+}
+
+// distances (negated inner products if mips) from q to each of the m
+// points in c, written to out
+template<typename T>
+void distance_batch(T const* q, T const* const* c, size_t m, unsigned d,
+		    float* out, bool mips) {
+  if (mips) {
+    ann_simd::active<T>.ip_batch(q, c, m, d, out);
+    for (size_t j = 0; j < m; j++) out[j] = -out[j];
+  } else ann_simd::active<T>.l2_batch(q, c, m, d, out);
+}
+
+template<typename T>
+char const* distance_isa() {return ann_simd::active<T>.isa;}
+
+float mips_distance(uint8_t *p, uint8_t *q, unsigned d){
+  return -ann_simd::active<uint8_t>.ip(p, q, d);
 }
 
 float mips_distance(int8_t *p, int8_t *q, unsigned d){
-  int result = 0;
-  for(int i=0; i<d; i++){
-    result += ((int32_t) q[i]) *
-                  ((int32_t) p[i]);
-  }
-  return -((float) result);
+  return -ann_simd::active<int8_t>.ip(p, q, d);
 }
 
 float mips_distance(float *q, uint8_t *p, unsigned d){
@@ -372,30 +661,15 @@ float mips_distance(float *q, int8_t *p, unsigned d){
 }
 
 float mips_distance(float *p, float *q, unsigned d){
-    efanna2e::DistanceL2 distfunc;
-    float result = 0;
-    for(int i=0; i<d; i++){
-      result += (q[i]) * (p[i]);
-    }
-    return -result;
+  return -ann_simd::active<float>.ip(p, q, d);
 }
 
 float distance(uint8_t *p, uint8_t *q, unsigned d){
-  int result = 0;
-  for(int i=0; i<d; i++){
-    result += ((int32_t)((int16_t) q[i] - (int16_t) p[i])) *
-                  ((int32_t)((int16_t) q[i] - (int16_t) p[i]));
-  }
-  return (float) result;
+  return ann_simd::active<uint8_t>.l2(p, q, d);
 }
 
 float distance(int8_t *p, int8_t *q, unsigned d){
-  int result = 0;
-  for(int i=0; i<d; i++){
-    result += ((int32_t)((int16_t) q[i] - (int16_t) p[i])) *
-                  ((int32_t)((int16_t) q[i] - (int16_t) p[i]));
-  }
-  return (float) result;
+  return ann_simd::active<int8_t>.l2(p, q, d);
 }
 
 float distance(float *q, uint8_t *p, unsigned d){
@@ -417,8 +691,7 @@ float distance(float *q, int8_t *p, unsigned d){
 }
 
 float distance(float *p, float *q, unsigned d){
-    efanna2e::DistanceL2 distfunc;
-    return distfunc.compare(p, q, d);
+  return ann_simd::active<float>.l2(p, q, d);
 }
 
 #endif //EFANNA2E_DISTANCE_H
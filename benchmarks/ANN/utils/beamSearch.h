@@ -32,13 +32,15 @@
 #include "parlay/random.h"
 #include "types.h"
 #include "indexTools.h"
+#include "quantization.h"
+#include "searchContext.h"
+#include <cstddef>
 #include <functional>
 #include <random>
+#include <type_traits>
 
 extern bool report_stats;
 
-using pid = std::pair<int, float>;
-
 // returns true if F \setminus V = emptyset
 bool intersect_nonempty(parlay::sequence<pid>& V, parlay::sequence<pid>& F) {
   for (int i = 0; i < F.size(); i++) {
@@ -72,87 +74,118 @@ void print_seq(parlay::sequence<int> seq) {
 template <typename T>
 std::pair<std::pair<parlay::sequence<pid>, parlay::sequence<pid>>, int> beam_search(
     Tvec_point<T>* p, parlay::sequence<Tvec_point<T>*>& v,
-    Tvec_point<T>* starting_point, int beamSize, unsigned d, bool mips, int k=0, float cut=1.14, int limit=-1) {
+    Tvec_point<T>* starting_point, int beamSize, unsigned d, bool mips, int k=0, float cut=1.14, int limit=-1,
+    quantized_points<T> const* QP=nullptr) {
   
   parlay::sequence<Tvec_point<T>*> start_points;
   start_points.push_back(starting_point);
-  return beam_search(p, v, start_points, beamSize, d, mips, k, cut, limit);
+  return beam_search(p, v, start_points, beamSize, d, mips, k, cut, limit, QP);
 
 }
 
 // updated version by Guy
-template <typename T>
-std::pair<std::pair<parlay::sequence<pid>, parlay::sequence<pid>>, size_t> beam_search(
+// Runs the search in the search_context of the calling worker and
+// returns it; the beam and the visited points are valid until the next
+// search by the same worker.  If QP is given the distances used to
+// traverse the graph, and hence those returned, are the approximate ones
+// on the quantized points.  If keep is given, only the neighbors j with
+// keep(j) are followed, e.g. the points matching a filter.
+template <typename T, typename Keep>
+search_context& beam_search_local(
     Tvec_point<T>* p, parlay::sequence<Tvec_point<T>*>& v,
-    parlay::sequence<Tvec_point<T>*> starting_points, int beamSize, unsigned d, bool mips, int k=0, float cut=1.14, int limit=-1) {
-  // initialize data structures
-  if(limit==-1) limit=v.size();
-  size_t dist_cmps = 0;
+    Tvec_point<T>* const* starting_points, size_t num_starts, int beamSize, unsigned d, bool mips,
+    int k, float cut, int limit, quantized_points<T> const* QP, Keep&& keep) {
+  static thread_local std::vector<int> starts;
+  static thread_local std::vector<int> kept;
+  static thread_local std::vector<T const*> pts;
+  static thread_local typename quantized_points<T>::query qq;
+  constexpr bool filtered = !std::is_same_v<std::decay_t<Keep>, std::nullptr_t>;
+  search_context& ctx = search_context::local();
   auto vvc = v[0]->coordinates.begin();
   long stride = v[1]->coordinates.begin() - v[0]->coordinates.begin();
-  std::vector<pid> visited;
-  auto less = [&](pid a, pid b) {
-      return a.second < b.second || (a.second == b.second && a.first < b.first); };
-  auto make_pid = [&] (int q) {
-      if(mips) return std::pair{q, mips_distance(vvc + q*stride, p->coordinates.begin(), d)};
-      else return std::pair{q, distance(vvc + q*stride, p->coordinates.begin(), d)};
-  };
-  int bits = std::ceil(std::log2(beamSize*beamSize))-2;
-  parlay::sequence<int> hash_table(1 << bits, -1);
-
-  auto pre_frontier = parlay::tabulate(starting_points.size(), [&] (size_t i) {
-    return make_pid(starting_points[i]->id);
-  });
-
-  dist_cmps += starting_points.size();
+  T const* pc = p->coordinates.begin();
+  if (QP != nullptr) QP->prepare(pc, qq);
+  starts.clear();
+  for (size_t i = 0; i < num_starts; i++) starts.push_back(starting_points[i]->id);
+  size_t maxDeg = v[0]->out_nbh.size();
+  if (pts.size() < std::max(maxDeg, starts.size())) pts.resize(std::max(maxDeg, starts.size()));
+  if (kept.size() < maxDeg) kept.resize(maxDeg);
+  // p is skipped if it is itself a point of the graph
+  int exclude = (p->id >= 0 && p->id < (int) v.size() && v[p->id] == p) ? p->id : -1;
+  auto nbrs = [&] (int i) {
+    auto &nbh = v[i]->out_nbh;
+    int deg = size_of(nbh);
+    if constexpr (filtered) {
+      int m = 0;
+      for (int j = 0; j < deg; j++) if (keep(nbh[j])) kept[m++] = nbh[j];
+      return std::pair<int const*, int>(kept.data(), m);
+    } else return std::pair<int const*, int>(nbh.begin(), deg);};
+  auto dist = [&] (int const* ids, size_t m, float* out) {
+    if (QP != nullptr) {QP->distances(qq, ids, m, out); return;}
+    for (size_t j = 0; j < m; j++) pts[j] = vvc + ids[j]*stride;
+    distance_batch<T>(pc, pts.data(), m, d, out, mips);};
+  ctx.search(starts.data(), starts.size(), nbrs, dist, [] (int) {}, beamSize, maxDeg, mips,
+	     k, cut, limit, exclude);
+  return ctx;
+}
 
-  auto frontier = parlay::sort(pre_frontier, less);
+template <typename T>
+search_context& beam_search_local(
+    Tvec_point<T>* p, parlay::sequence<Tvec_point<T>*>& v,
+    Tvec_point<T>* const* starting_points, size_t num_starts, int beamSize, unsigned d, bool mips,
+    int k=0, float cut=1.14, int limit=-1, quantized_points<T> const* QP=nullptr) {
+  return beam_search_local(p, v, starting_points, num_starts, beamSize, d, mips, k, cut, limit,
+			   QP, nullptr);
+}
 
-  std::vector<pid> unvisited_frontier(beamSize);
-  parlay::sequence<pid> new_frontier(beamSize + v[0]->out_nbh.size());
-  unvisited_frontier[0] = frontier[0];
-  int remain = 1;
-  int num_visited = 0;
+// as beam_search_local, but returns copies of the beam and of the
+// visited points, both sorted by distance
+template <typename T>
+std::pair<std::pair<parlay::sequence<pid>, parlay::sequence<pid>>, size_t> beam_search(
+    Tvec_point<T>* p, parlay::sequence<Tvec_point<T>*>& v,
+    parlay::sequence<Tvec_point<T>*> starting_points, int beamSize, unsigned d, bool mips, int k=0, float cut=1.14, int limit=-1,
+    quantized_points<T> const* QP=nullptr) {
+  search_context& ctx = beam_search_local(p, v, starting_points.begin(), starting_points.size(),
+					  beamSize, d, mips, k, cut, limit, QP);
+  auto frontier = parlay::tabulate(ctx.beam_size, [&] (size_t i) {
+      return pid(ctx.beam[i].id, ctx.beam[i].dist);}, 1000000);
+  return std::make_pair(std::make_pair(std::move(frontier), ctx.sorted_visited()), ctx.dist_cmps);
+}
 
-  // terminate beam search when the entire frontier has been visited
-  while (remain > 0 && num_visited<limit) {
-    // the next node to visit is the unvisited frontier node that is closest to p
-    pid currentPid = unvisited_frontier[0];
-    Tvec_point<T>* current = v[currentPid.first];
-    auto nbh = current->out_nbh.cut(0, size_of(current->out_nbh));
-    auto candidates = parlay::filter(nbh,  [&] (int a) {
-	     int loc = parlay::hash64_2(a) & ((1 << bits) - 1);
-	     if (a == p->id || hash_table[loc] == a) return false;
-	     hash_table[loc] = a;
-	     return true;});
-    auto pairCandidates = parlay::map(candidates, [&] (long c) {return make_pid(c);}, 1000);
-    dist_cmps += candidates.size();
-    auto sortedCandidates = parlay::sort(pairCandidates, less);
-    auto f_iter = std::set_union(frontier.begin(), frontier.end(),
-				 sortedCandidates.begin(), sortedCandidates.end(),
-				 new_frontier.begin(), less);
-    size_t f_size = std::min<size_t>(beamSize, f_iter - new_frontier.begin());
-    if (k > 0 && f_size > k) {
-      if(mips){
-        f_size = (std::upper_bound(new_frontier.begin(), new_frontier.begin() + f_size,
-				std::pair{0, -cut * new_frontier[k].second}, less)
-		- new_frontier.begin());
-      }
-      else{f_size = (std::upper_bound(new_frontier.begin(), new_frontier.begin() + f_size,
-				std::pair{0, cut * new_frontier[k].second}, less)
-		- new_frontier.begin());}
-    }
-    frontier = parlay::tabulate(f_size, [&] (long i) {return new_frontier[i];});
-    visited.insert(std::upper_bound(visited.begin(), visited.end(), currentPid, less), currentPid);
-    auto uf_iter = std::set_difference(frontier.begin(), frontier.end(),
-				 visited.begin(), visited.end(),
-				 unvisited_frontier.begin(), less);
-    remain = uf_iter - unvisited_frontier.begin();
-    num_visited++;
-  }
-  return std::make_pair(std::make_pair(frontier, parlay::to_sequence(visited)), dist_cmps);
+// recomputes the distances of the points in the beam of ctx to p on the
+// full precision coordinates and sorts the beam by them, used after
+// searching on quantized points
+template <typename T>
+void rerank(Tvec_point<T>* p, parlay::sequence<Tvec_point<T>*>& v,
+	    search_context& ctx, unsigned d, bool mips) {
+  static thread_local std::vector<T const*> pts;
+  size_t m = ctx.beam_size;
+  if (pts.size() < m) pts.resize(m);
+  if (ctx.dists.size() < m) ctx.dists.resize(m);
+  for (size_t j = 0; j < m; j++) pts[j] = v[ctx.beam[j].id]->coordinates.begin();
+  distance_batch<T>(p->coordinates.begin(), pts.data(), m, d, ctx.dists.data(), mips);
+  for (size_t j = 0; j < m; j++) ctx.beam[j].dist = ctx.dists[j];
+  std::sort(ctx.beam.begin(), ctx.beam.begin() + m, [&] (auto const &a, auto const &b) {
+      return a.dist < b.dist || (a.dist == b.dist && a.id < b.id);});
+  ctx.dist_cmps += m;
 }
 
+// searches for p, re-ranking on the full precision coordinates if QP is
+// given, and sets its k nearest neighbors and its search counters; keep,
+// if given, is the filter of beam_search_local
+template <typename T, typename Keep = std::nullptr_t>
+void search_one(Tvec_point<T>* p, parlay::sequence<Tvec_point<T>*>& v, int beamSizeQ, int k,
+		unsigned d, Tvec_point<T>* const* starting_points, size_t num_starts, bool mips,
+		float cut, int limit, quantized_points<T> const* QP=nullptr, Keep&& keep=nullptr) {
+  search_context& ctx = beam_search_local(p, v, starting_points, num_starts,
+					  beamSizeQ, d, mips, k, cut, limit, QP,
+					  std::forward<Keep>(keep));
+  if (QP != nullptr) rerank(p, v, ctx, d, mips);
+  p->ngh = parlay::tabulate(k, [&] (size_t j) {
+      return j < ctx.beam_size ? ctx.beam[j].id : -1;}, 1000000);
+  p->visited = ctx.visited.size();
+  p->dist_calls = ctx.dist_cmps;
+}
 
 // searches every element in q starting from a randomly selected point
 template <typename T>
@@ -177,36 +210,30 @@ void beamSearchRandom(parlay::sequence<Tvec_point<T>*>& q,
   });
 
   parlay::parallel_for(0, q.size(), [&](size_t i) {
-    parlay::sequence<int> neighbors = parlay::sequence<int>(k);
-    size_t index = indices[i];
-    Tvec_point<T>* start = v[index];
-    parlay::sequence<pid> beamElts;
-    parlay::sequence<pid> visitedElts;
-    auto [pairElts, dist_cmps] = beam_search(q[i], v, start, beamSizeQ, d, mips, k, cut, limit);
-    beamElts = pairElts.first;
-    visitedElts = pairElts.second;
-    for (int j = 0; j < k; j++) {
-      neighbors[j] = beamElts[j].first;
-    }
-    q[i]->ngh = neighbors;
-    if (report_stats) {q[i]->visited = visitedElts.size(); q[i]->dist_calls = dist_cmps; }
-  });
+    Tvec_point<T>* start = v[indices[i]];
+    search_context& ctx = beam_search_local(q[i], v, &start, 1, beamSizeQ, d, mips, k, cut, limit);
+    q[i]->ngh = parlay::tabulate(k, [&] (size_t j) {
+	return j < ctx.beam_size ? ctx.beam[j].id : -1;}, 1000000);
+    if (report_stats) {q[i]->visited = ctx.visited.size(); q[i]->dist_calls = ctx.dist_cmps; }
+  }, 1);
 }
 
 template <typename T>
 void searchAll(parlay::sequence<Tvec_point<T>*>& q,
                       parlay::sequence<Tvec_point<T>*>& v, int beamSizeQ, int k,
-                      unsigned d, Tvec_point<T>* starting_point, bool mips, float cut, int limit) {
+                      unsigned d, Tvec_point<T>* starting_point, bool mips, float cut, int limit,
+                      quantized_points<T> const* QP=nullptr) {
     // std::cout << "Mips: " << mips <<  std::endl;
     parlay::sequence<Tvec_point<T>*> start_points;
     start_points.push_back(starting_point);
-    searchAll(q, v, beamSizeQ, k, d, start_points, mips, cut, limit);
+    searchAll(q, v, beamSizeQ, k, d, start_points, mips, cut, limit, QP);
 }
 
 template <typename T>
 void searchAll(parlay::sequence<Tvec_point<T>*>& q,
                       parlay::sequence<Tvec_point<T>*>& v, int beamSizeQ, int k,
-                      unsigned d, parlay::sequence<Tvec_point<T>*> starting_points, bool mips, float cut, int limit) {
+                      unsigned d, parlay::sequence<Tvec_point<T>*> starting_points, bool mips, float cut, int limit,
+                      quantized_points<T> const* QP=nullptr) {
   // std::cout << "Mips: " << mips << std::endl;
   if ((k + 1) > beamSizeQ) {
     std::cout << "Error: beam search parameter Q = " << beamSizeQ
@@ -214,17 +241,9 @@ void searchAll(parlay::sequence<Tvec_point<T>*>& q,
     abort();
   }
   parlay::parallel_for(0, q.size(), [&](size_t i) {
-    parlay::sequence<int> neighbors = parlay::sequence<int>(k);
-    auto [pairElts, dist_cmps] = beam_search(q[i], v, starting_points, beamSizeQ, d, mips, k, cut, limit);
-    auto [beamElts, visitedElts] = pairElts;
-      for (int j = 0; j < k; j++) {
-        neighbors[j] = beamElts[j].first;
-      }
-    q[i]->ngh = neighbors;
-    q[i]->visited = visitedElts.size();
-    q[i]->dist_calls = dist_cmps; 
-
-  });
+    search_one(q[i], v, beamSizeQ, k, d, starting_points.begin(), starting_points.size(),
+	       mips, cut, limit, QP);
+  }, 1);
 }
 
 template<typename T>
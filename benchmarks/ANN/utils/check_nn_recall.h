@@ -20,7 +20,12 @@
 // OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
 // WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
+#ifndef CHECK_NN_RECALL
+#define CHECK_NN_RECALL
+
 #include <algorithm>
+#include <chrono>
+#include <sstream>
 #include "parlay/parallel.h"
 #include "parlay/primitives.h"
 #include "common/geometry.h"
@@ -29,37 +34,20 @@
 #include "types.h"
 // #include "parse_results.h"
 #include "beamSearch.h"
+#include "flatGraph.h"
 #include "csvfile.h"
 
+extern std::string graph_layout;
+extern size_t query_batch;
+extern std::string query_beams;
+
+// the fraction of the 10 nearest neighbors in groundTruth (counting
+// ties at the 10th if distances are given) found in q[i]->ngh
 template<typename T>
-nn_result checkRecall(
-        parlay::sequence<Tvec_point<T>*> &v,
-        parlay::sequence<Tvec_point<T>*> &q,
-        parlay::sequence<ivec_point> groundTruth,
-        int k,
-        int beamQ,
-        float cut,
-        unsigned d,
-        bool random,
-        int limit,
-        int start_point,
-        bool mips) {
-  parlay::internal::timer t;
+float nn_recall(parlay::sequence<Tvec_point<T>*> &q, parlay::sequence<ivec_point> &groundTruth){
   int r = 10;
-  float query_time;
-  if(random){
-    beamSearchRandom(q, v, beamQ, k, d, mips, cut, limit);
-    t.next_time();
-    beamSearchRandom(q, v, beamQ, k, d, mips, cut, limit);
-    query_time = t.next_time();
-  }else{
-    searchAll(q, v, beamQ, k, d, v[start_point], mips, cut, limit);
-    t.next_time();
-    searchAll(q, v, beamQ, k, d, v[start_point], mips, cut, limit);
-    query_time = t.next_time();
-  }
   float recall = 0.0;
-  bool dists_present = (groundTruth[0].distances.size() != 0);
+  bool dists_present = (groundTruth.size() > 0 && groundTruth[0].distances.size() != 0);
   if (groundTruth.size() > 0 && !dists_present) {
     size_t n = q.size();
     int numCorrect = 0;
@@ -96,6 +84,45 @@ nn_result checkRecall(
     }
     recall = static_cast<float>(numCorrect)/static_cast<float>(r*n);
   }
+  return recall;
+}
+
+template<typename T>
+nn_result checkRecall(
+        parlay::sequence<Tvec_point<T>*> &v,
+        parlay::sequence<Tvec_point<T>*> &q,
+        parlay::sequence<ivec_point> groundTruth,
+        int k,
+        int beamQ,
+        float cut,
+        unsigned d,
+        bool random,
+        int limit,
+        int start_point,
+        bool mips,
+        quantized_points<T> const* QP = nullptr,
+        flat_graph<T> const* FG = nullptr) {
+  parlay::internal::timer t;
+  float query_time;
+  if(FG != nullptr){
+    parlay::sequence<int> starts;
+    if(!random) starts.push_back(start_point);
+    flatSearchAll(q, *FG, beamQ, k, starts, mips, cut, limit);
+    t.next_time();
+    flatSearchAll(q, *FG, beamQ, k, starts, mips, cut, limit);
+    query_time = t.next_time();
+  }else if(random){
+    beamSearchRandom(q, v, beamQ, k, d, mips, cut, limit);
+    t.next_time();
+    beamSearchRandom(q, v, beamQ, k, d, mips, cut, limit);
+    query_time = t.next_time();
+  }else{
+    searchAll(q, v, beamQ, k, d, v[start_point], mips, cut, limit, QP);
+    t.next_time();
+    searchAll(q, v, beamQ, k, d, v[start_point], mips, cut, limit, QP);
+    query_time = t.next_time();
+  }
+  float recall = nn_recall(q, groundTruth);
   float QPS = q.size()/query_time;
   auto stats = query_stats(q);
   nn_result N(recall, stats, QPS, k, beamQ, cut, q.size());
@@ -119,6 +146,86 @@ void write_to_csv(std::string csv_filename, parlay::sequence<float> buckets,
   csv << endrow;
 }
 
+// Answers the queries as a server would: in batches of batch queries,
+// one batch after the other, with the queries of a batch searched in
+// parallel and each one timed on its own.  QPS is over the whole run.
+template<typename T>
+serve_result serveQueries(
+        parlay::sequence<Tvec_point<T>*> &v,
+        parlay::sequence<Tvec_point<T>*> &q,
+        parlay::sequence<ivec_point> &groundTruth,
+        int k, int beamQ, float cut, size_t batch, unsigned d, bool random,
+        int start_point, bool mips,
+        quantized_points<T> const* QP = nullptr,
+        flat_graph<T> const* FG = nullptr) {
+  parlay::random_generator gen;
+  std::uniform_int_distribution<long> dis(0, v.size()-1);
+  parlay::sequence<double> latency(q.size());
+  auto run = [&] () {
+    for(size_t b=0; b<q.size(); b+=batch){
+      parlay::parallel_for(b, std::min(b+batch, q.size()), [&] (size_t i) {
+        auto start = std::chrono::steady_clock::now();
+        auto r = gen[i];
+        int s = random ? dis(r) : start_point;
+        if(FG != nullptr) flat_search_one(q[i], *FG, beamQ, k, &s, 1, mips, cut, -1);
+        else search_one(q[i], v, beamQ, k, d, &v[s], 1, mips, cut, -1, QP);
+        latency[i] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      }, 1);
+    }
+  };
+  parlay::internal::timer t;
+  run();
+  t.next_time();
+  run();
+  double query_time = t.next_time();
+  float recall = nn_recall(q, groundTruth);
+  return serve_result(recall, latency_stats(latency), query_stats(q), q.size()/query_time,
+    k, beamQ, cut, batch, q.size());
+}
+
+void write_serve_csv(std::string csv_filename, parlay::sequence<serve_result> results, Graph G){
+  csvfile csv(csv_filename);
+  csv << "GRAPH" << "Parameters" << "Size" << "Build time" << "Avg degree" << "Max degree" << endrow;
+  csv << G.name << G.params << G.size << G.time << G.avg_deg << G.max_deg << endrow;
+  csv << endrow;
+  csv << "Num queries" << "Batch" << "k" << "Q" << "cut" << "Recall" << "QPS" << "Avg latency" <<
+    "P50 latency" << "P99 latency" << "Average Cmps" << "Tail Cmps" << "Average Visited" << "Tail Visited" << endrow;
+  for(serve_result &N : results){
+    csv << N.num_queries << N.batch << N.k << N.beamQ << N.cut << N.recall << N.QPS << N.avg_latency <<
+      N.p50_latency << N.p99_latency << N.avg_cmps << N.tail_cmps << N.avg_visited << N.tail_visited << endrow;
+  }
+  csv << endrow;
+  csv << endrow;
+}
+
+// sweeps the beam widths in query_beams (a comma separated list, or
+// the beams of search_and_parse if empty) in serving mode, giving one
+// point of the QPS-recall curve per width
+template<typename T>
+void serve_sweep(Graph G, parlay::sequence<Tvec_point<T>*> &v, parlay::sequence<Tvec_point<T>*> &q,
+    parlay::sequence<ivec_point> &groundTruth, char* res_file, bool mips, bool random, int start_point,
+    quantized_points<T> const* QP, flat_graph<T> const* FG){
+    unsigned d = v[0]->coordinates.size();
+    std::vector<int> beams = {15, 20, 30, 50, 75, 100, 125, 250, 500};
+    if(query_beams != ""){
+      beams.clear();
+      std::stringstream ss(query_beams);
+      for(std::string b; std::getline(ss, b, ',');) beams.push_back(std::stoi(b));
+    }
+    std::cout << "Serving " << q.size() << " queries in batches of " << query_batch << std::endl;
+    parlay::sequence<serve_result> results;
+    for(int Q : beams){
+      if(Q <= 10){
+        std::cout << "Error: beam width " << Q << " must be larger than k = 10" << std::endl;
+        abort();
+      }
+      results.push_back(serveQueries(v, q, groundTruth, 10, Q, 1.14, query_batch, d, random,
+        start_point, mips, QP, FG));
+      results[results.size()-1].print();
+    }
+    if(res_file != NULL) write_serve_csv(std::string(res_file), results, G);
+}
+
 parlay::sequence<int> calculate_limits(size_t avg_visited){
   parlay::sequence<int> L(9);
   for(float i=1; i<10; i++){
@@ -130,32 +237,54 @@ parlay::sequence<int> calculate_limits(size_t avg_visited){
 
 template<typename T>
 void search_and_parse(Graph G, parlay::sequence<Tvec_point<T>*> &v, parlay::sequence<Tvec_point<T>*> &q, 
-    parlay::sequence<ivec_point> groundTruth, char* res_file, bool mips, bool random=true, int start_point=0){
+    parlay::sequence<ivec_point> groundTruth, char* res_file, bool mips, bool random=true, int start_point=0,
+    quantized_points<T> const* QP = nullptr, flat_graph<T>* flat = nullptr){
     unsigned d = v[0]->coordinates.size();
 
+    // searches on quantized points keep to the pointer based layout; a
+    // flat graph passed in (e.g. from an index file) is used as is
+    flat_graph<T>* FG = nullptr;
+    bool own_FG = false;
+    if(graph_layout == "flat" && QP == nullptr && flat != nullptr) FG = flat;
+    else if(graph_layout != "ptr" && QP == nullptr){
+      own_FG = true;
+      parlay::internal::timer t;
+      FG = new flat_graph<T>(v, graph_layout == "bfs", start_point);
+      std::cout << "Flat graph layout: " << FG->stride << " bytes per point"
+        << (graph_layout == "bfs" ? ", BFS order" : "") << ", built in " << t.next_time() << std::endl;
+    }
+
+    if(query_batch > 0){
+      serve_sweep(G, v, q, groundTruth, res_file, mips, random, start_point, QP, FG);
+      if(own_FG) delete FG;
+      return;
+    }
+
     parlay::sequence<nn_result> results;
     std::vector<int> beams = {15, 20, 30, 50, 75, 100, 125, 250, 500};
     std::vector<int> allk = {10, 15, 20, 30, 50, 100};
     std::vector<float> cuts = {1.1, 1.125, 1.15, 1.175, 1.2, 1.25};
     for (float cut : cuts)
       for (float Q : beams) 
-        results.push_back(checkRecall(v, q, groundTruth, 10, Q, cut, d, random, -1, start_point, mips));
+        results.push_back(checkRecall(v, q, groundTruth, 10, Q, cut, d, random, -1, start_point, mips, QP, FG));
 
     for (float cut : cuts)
       for (int kk : allk)
-        results.push_back(checkRecall(v, q, groundTruth, kk, 500, cut, d, random, -1, start_point, mips));
+        results.push_back(checkRecall(v, q, groundTruth, kk, 500, cut, d, random, -1, start_point, mips, QP, FG));
 
     // check "limited accuracy"
     parlay::sequence<int> limits = calculate_limits(results[0].avg_visited);
     for(int l : limits){
-      results.push_back(checkRecall(v, q, groundTruth, 10, 15, 1.14, d, random, l, start_point, mips));
+      results.push_back(checkRecall(v, q, groundTruth, 10, 15, 1.14, d, random, l, start_point, mips, QP, FG));
     }
 
     // check "best accuracy"
-    results.push_back(checkRecall(v, q, groundTruth, 100, 1000, 10.0, d, random, -1, start_point, mips));
+    results.push_back(checkRecall(v, q, groundTruth, 100, 1000, 10.0, d, random, -1, start_point, mips, QP, FG));
 
     parlay::sequence<float> buckets = {.1, .15, .2, .25, .3, .35, .4, .45, .5, .55, .6, .65, .7, .73, .75, .77, .8, .83, .85, .87, .9, .93, .95, .97, .99, .995, .999};
     auto [res, ret_buckets] = parse_result(results, buckets);
     if(res_file != NULL) write_to_csv(std::string(res_file), ret_buckets, res, G);
+    if(own_FG) delete FG;
 }
 
+#endif
@@ -0,0 +1,215 @@
+// This code is part of the Problem Based Benchmark Suite (PBBS)
+// Copyright (c) 2011 Guy Blelloch and the PBBS team
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights (to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef FLATGRAPH
+#define FLATGRAPH
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include <sys/mman.h>
+#include "parlay/parallel.h"
+#include "parlay/primitives.h"
+#include "parlay/random.h"
+#include "types.h"
+#include "indexTools.h"
+#include "NSGDist.h"
+#include "searchContext.h"
+
+extern bool report_stats;
+
+// A read-only copy of a built graph in which each vertex is one record
+//
+//   [degree | maxDeg neighbor ids | padding | coordinates | padding]
+//
+// in a single 64-byte aligned block, so that visiting a vertex touches
+// one contiguous range of memory instead of the Tvec_point, its
+// neighbor slice and its coordinate slice.  Optionally the vertices are
+// renumbered in BFS order from the start point, so that vertices close
+// in the graph are also close in memory.  The search over it is the
+// same as beam_search, but prefetches the records of the candidates
+// before computing their distances, and of the next vertex to visit.
+template<typename T>
+struct flat_graph {
+  static constexpr size_t line = 64;
+  static constexpr size_t huge_page = 1 << 21;
+
+  size_t n;
+  unsigned d;
+  int maxDeg;
+  size_t stride;        // bytes per record, a multiple of line
+  size_t coord_offset;  // bytes from the start of a record to its coordinates
+  char* block;
+  bool owned = true;             // false if block belongs to someone else
+  parlay::sequence<int> new_id;  // empty if not reordered
+  parlay::sequence<int> old_id;
+
+  flat_graph(parlay::sequence<Tvec_point<T>*> &v, bool reorder = false, int start = 0)
+    : n(v.size()), d(v[0]->coordinates.size()), maxDeg(v[0]->out_nbh.size()) {
+    coord_offset = round_up((maxDeg + 1) * sizeof(int), alignof(T) > 16 ? alignof(T) : 16);
+    stride = round_up(coord_offset + d * sizeof(T), line);
+    // large blocks are aligned to huge pages and asked to be backed by them
+    size_t align = (n * stride >= huge_page) ? huge_page : line;
+    block = (char*) std::aligned_alloc(align, round_up(n * stride, align));
+    if (block == nullptr) {
+      std::cout << "Error: could not allocate flat graph of " << n * stride << " bytes" << std::endl;
+      abort();
+    }
+#ifdef MADV_HUGEPAGE
+    if (align == huge_page) madvise(block, round_up(n * stride, align), MADV_HUGEPAGE);
+#endif
+    if (reorder) bfs_order(v, start);
+    parlay::parallel_for(0, n, [&] (size_t i) {
+      Tvec_point<T>* p = v[original(i)];
+      int deg = size_of(p->out_nbh);
+      int* nb = neighbors(i);
+      nb[-1] = deg;
+      for (int j = 0; j < deg; j++) nb[j] = renumbered(p->out_nbh[j]);
+      for (int j = deg; j < maxDeg; j++) nb[j] = -1;
+      std::copy(p->coordinates.begin(), p->coordinates.end(), coordinates(i));
+    }, 100);
+  }
+
+  // a flat graph in a block laid out by another one, e.g. in a mapped
+  // index file
+  flat_graph(char* b, size_t n, unsigned d, int maxDeg, size_t stride, size_t coord_offset)
+    : n(n), d(d), maxDeg(maxDeg), stride(stride), coord_offset(coord_offset),
+      block(b), owned(false) {}
+
+  ~flat_graph() {if (owned) std::free(block);}
+  flat_graph(flat_graph const&) = delete;
+  flat_graph& operator=(flat_graph const&) = delete;
+
+  static size_t round_up(size_t x, size_t a) {return (x + a - 1) / a * a;}
+
+  int renumbered(int i) const {return new_id.size() == 0 ? i : new_id[i];}
+  int original(int i) const {return old_id.size() == 0 ? i : old_id[i];}
+
+  char* record(size_t i) const {return block + i * stride;}
+  int degree(size_t i) const {return ((int*) record(i))[0];}
+  int* neighbors(size_t i) const {return ((int*) record(i)) + 1;}
+  T* coordinates(size_t i) const {return (T*) (record(i) + coord_offset);}
+
+  void prefetch(size_t i) const {
+    char* r = record(i);
+    for (size_t o = 0; o < stride; o += line) __builtin_prefetch(r + o);
+  }
+
+  size_t bytes() const {return n * stride;}
+
+  // renumbers the vertices in the order a BFS from start visits them,
+  // followed by the unreachable ones in their original order
+  void bfs_order(parlay::sequence<Tvec_point<T>*> &v, int start) {
+    std::vector<std::atomic<bool>> seen(n);
+    parlay::parallel_for(0, n, [&] (size_t i) {seen[i] = false;});
+    parlay::sequence<int> order;
+    order.reserve(n);
+    parlay::sequence<int> frontier(1, start);
+    seen[start] = true;
+    while (frontier.size() > 0) {
+      order.append(frontier);
+      auto next = parlay::flatten(parlay::map(frontier, [&] (int u) {
+	    auto nbh = v[u]->out_nbh.cut(0, size_of(v[u]->out_nbh));
+	    return parlay::filter(nbh, [&] (int w) {
+		bool f = false;
+		return seen[w].compare_exchange_strong(f, true);});}));
+      frontier = std::move(next);
+    }
+    if (order.size() < n)
+      order.append(parlay::filter(parlay::iota<int>(n), [&] (int i) {return !seen[i];}));
+    old_id = std::move(order);
+    new_id = parlay::sequence<int>(n);
+    parlay::parallel_for(0, n, [&] (size_t i) {new_id[old_id[i]] = i;});
+  }
+};
+
+// beam search for the point with coordinates p on a flat graph, from
+// starting points given by their original ids, in the search_context of
+// the calling worker; the ids in its beam and visited list are the
+// renumbered ones
+template<typename T>
+search_context& flat_beam_search(
+    T const* p, flat_graph<T> const &G, int const* starting_points, size_t num_starts,
+    int beamSize, bool mips, int k=0, float cut=1.14, int limit=-1) {
+  static thread_local std::vector<int> starts;
+  static thread_local std::vector<T const*> pts;
+  search_context& ctx = search_context::local();
+  unsigned d = G.d;
+  starts.clear();
+  for (size_t i = 0; i < num_starts; i++) starts.push_back(G.renumbered(starting_points[i]));
+  if (pts.size() < std::max<size_t>(G.maxDeg, num_starts))
+    pts.resize(std::max<size_t>(G.maxDeg, num_starts));
+  auto nbrs = [&] (int i) {return std::pair<int const*, int>(G.neighbors(i), G.degree(i));};
+  auto dist = [&] (int const* ids, size_t m, float* out) {
+    for (size_t j = 0; j < m; j++) G.prefetch(ids[j]);
+    for (size_t j = 0; j < m; j++) pts[j] = G.coordinates(ids[j]);
+    distance_batch<T>(p, pts.data(), m, d, out, mips);};
+  auto pre = [&] (int i) {G.prefetch(i);};
+  ctx.search(starts.data(), starts.size(), nbrs, dist, pre, beamSize, G.maxDeg, mips,
+	     k, cut, limit);
+  return ctx;
+}
+
+// searches for p on a flat graph and sets its k nearest neighbors, by
+// their original ids, and its search counters
+template<typename T>
+void flat_search_one(Tvec_point<T>* p, flat_graph<T> const &G, int beamSizeQ, int k,
+		     int const* starting_points, size_t num_starts, bool mips, float cut, int limit) {
+  search_context& ctx = flat_beam_search(p->coordinates.begin(), G, starting_points, num_starts,
+					 beamSizeQ, mips, k, cut, limit);
+  p->ngh = parlay::tabulate(k, [&] (size_t j) {
+      return j < ctx.beam_size ? G.original(ctx.beam[j].id) : -1;}, 1000000);
+  p->visited = ctx.visited.size();
+  p->dist_calls = ctx.dist_cmps;
+}
+
+// searches every element in q on a flat graph, from the given starting
+// points, or from a random point for each query if there are none
+template <typename T>
+void flatSearchAll(parlay::sequence<Tvec_point<T>*>& q, flat_graph<T> const &G,
+		   int beamSizeQ, int k, parlay::sequence<int> const &starting_points,
+		   bool mips, float cut, int limit) {
+  if ((k + 1) > beamSizeQ) {
+    std::cout << "Error: beam search parameter Q = " << beamSizeQ
+              << " same size or smaller than k = " << k << std::endl;
+    abort();
+  }
+  parlay::random_generator gen;
+  std::uniform_int_distribution<long> dis(0, G.n-1);
+  parlay::parallel_for(0, q.size(), [&](size_t i) {
+    int random_start;
+    int const* start = starting_points.begin();
+    size_t num_starts = starting_points.size();
+    if (num_starts == 0) {
+      auto r = gen[i];
+      random_start = dis(r);
+      start = &random_start;
+      num_starts = 1;
+    }
+    flat_search_one(q[i], G, beamSizeQ, k, start, num_starts, mips, cut, limit);
+  }, 1);
+}
+
+#endif
@@ -0,0 +1,70 @@
+// This code is part of the Problem Based Benchmark Suite (PBBS)
+// Copyright (c) 2011 Guy Blelloch and the PBBS team
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights (to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef IN_EDGES
+#define IN_EDGES
+
+#include <algorithm>
+#include "parlay/parallel.h"
+#include "parlay/primitives.h"
+
+// A record of the in-neighbors of every point of a graph, so that the
+// points pointing at a set of deleted points can be found without
+// scanning every out-list.  It may hold duplicates and sources whose
+// edge has since been pruned away, so callers check each source against
+// its out-list.  add drops both from a list whenever it has doubled
+// since they were last dropped.  Different points can be updated
+// concurrently, a single point cannot.
+struct in_edge_record {
+  struct entry {
+    parlay::sequence<int> sources;
+    size_t compacted = 0;   // size of sources after the last compact
+  };
+  parlay::sequence<entry> in;
+
+  // grows the record to hold the points 0..n-1, keeping its contents
+  void resize(size_t n) {
+    if (n > in.size()) in.resize(n);
+  }
+
+  void clear() {in = parlay::sequence<entry>(in.size());}
+  void clear(int p) {in[p] = entry();}
+
+  parlay::sequence<int> const &sources(int p) const {return in[p].sources;}
+
+  // adds the sources of new edges into p, then compacts the list if it
+  // has doubled; points_to(u, p) tells if u still has the edge (u, p)
+  template <typename Seq, typename F>
+  void add(int p, Seq const &srcs, size_t min_size, F const &points_to) {
+    entry &e = in[p];
+    e.sources.append(srcs);
+    if (e.sources.size() > std::max(2 * e.compacted, min_size)) {
+      std::sort(e.sources.begin(), e.sources.end());
+      auto end = std::unique(e.sources.begin(), e.sources.end());
+      end = std::remove_if(e.sources.begin(), end, [&] (int u) {return !points_to(u, p);});
+      e.sources.resize(end - e.sources.begin());
+      e.compacted = e.sources.size();
+    }
+  }
+};
+
+#endif
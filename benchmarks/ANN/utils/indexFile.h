@@ -0,0 +1,348 @@
+// This code is part of the Problem Based Benchmark Suite (PBBS)
+// Copyright (c) 2011 Guy Blelloch and the PBBS team
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights (to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef INDEXFILE
+#define INDEXFILE
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include "parlay/parallel.h"
+#include "parlay/primitives.h"
+#include "parlay/internal/get_time.h"
+#include "types.h"
+#include "flatGraph.h"
+#include "quantization.h"
+#include "stats.h"
+#include "parse_results.h"
+#include "check_nn_recall.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// *************************************************************
+//  INDEX FILES
+// *************************************************************
+
+// An index file holds everything needed to answer queries on a built
+// graph, so that it can be built once and then served by mapping the
+// file instead of rebuilding:
+//
+//   header        (index_header, padded to a page)
+//   start points  (num_starts ints, original ids)
+//   records       (page aligned, the block of a flat_graph: for every
+//                  point its degree, neighbors and coordinates)
+//   quantization  (if the graph was built on quantized points)
+//
+// The checksum in the header covers everything after the header.
+
+struct index_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t type;          // one of the index_type codes
+  uint64_t n;
+  uint32_t d;
+  uint32_t maxDeg;
+  uint64_t stride;
+  uint64_t coord_offset;
+  uint32_t num_starts;    // 0 if searches start from random points
+  uint32_t mips;
+  double build_time;
+  char algorithm[32];
+  char params[128];
+  uint64_t starts_offset;
+  uint64_t records_offset;
+  uint64_t quant_offset;  // 0 if not quantized
+  uint64_t file_size;
+  uint64_t checksum;
+};
+
+constexpr char index_magic[8] = {'P','B','B','S','A','N','N','\0'};
+constexpr uint32_t index_version = 1;
+constexpr size_t index_page = 4096;
+
+template<typename T> uint32_t index_type();
+template<> inline uint32_t index_type<float>() {return 0;}
+template<> inline uint32_t index_type<uint8_t>() {return 1;}
+template<> inline uint32_t index_type<int8_t>() {return 2;}
+
+inline std::string index_type_name(uint32_t t) {
+  return t == 0 ? "float" : (t == 1 ? "uint8" : (t == 2 ? "int8" : "unknown"));
+}
+
+// What the build leaves for write_index: set by the ANN routines of the
+// graph based algorithms, the driver writes the file after timing.
+struct ann_index_info {
+  std::string algorithm;
+  std::string params;
+  parlay::sequence<int> starts;
+  double build_time = 0;
+  bool mips = false;
+  std::shared_ptr<void> quant;   // quantized_points<T>, if any
+};
+
+extern ann_index_info index_info;
+
+inline void set_index_info(std::string algorithm, std::string params, parlay::sequence<int> starts,
+			   double build_time, bool mips, std::shared_ptr<void> quant = nullptr) {
+  index_info.algorithm = algorithm;
+  index_info.params = params;
+  index_info.starts = std::move(starts);
+  index_info.build_time = build_time;
+  index_info.mips = mips;
+  index_info.quant = std::move(quant);
+}
+
+// hashes 1MB blocks in parallel and combines the results
+inline uint64_t index_checksum(char const* p, size_t len) {
+  size_t block = 1 << 20;
+  size_t nb = (len + block - 1) / block;
+  auto h = parlay::tabulate(nb, [&] (size_t b) {
+      uint64_t x = parlay::hash64(b);
+      size_t i = b * block, e = std::min(len, i + block);
+      for (; i + 8 <= e; i += 8) {
+	uint64_t w;
+	memcpy(&w, p + i, 8);
+	x = parlay::hash64(x ^ w);
+      }
+      for (; i < e; i++) x = parlay::hash64(x ^ (uint8_t) p[i]);
+      return x;}, 1);
+  uint64_t r = len;
+  for (size_t b = 0; b < nb; b++) r = parlay::hash64(r ^ h[b]);
+  return r;
+}
+
+inline void pad_to(std::ofstream &out, size_t align) {
+  size_t pos = out.tellp();
+  size_t padded = (pos + align - 1) / align * align;
+  for (; pos < padded; pos++) out.put(0);
+}
+
+template<typename T>
+void write_index(parlay::sequence<Tvec_point<T>*> &v, char const* outFile) {
+  parlay::internal::timer t;
+  if (index_info.algorithm.empty()) {
+    std::cout << "Error: no graph index to save" << std::endl;
+    abort();
+  }
+  auto QP = std::static_pointer_cast<quantized_points<T>>(index_info.quant);
+  flat_graph<T> G(v);
+  index_header h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, index_magic, 8);
+  h.version = index_version;
+  h.type = index_type<T>();
+  h.n = G.n;
+  h.d = G.d;
+  h.maxDeg = G.maxDeg;
+  h.stride = G.stride;
+  h.coord_offset = G.coord_offset;
+  h.num_starts = index_info.starts.size();
+  h.mips = index_info.mips;
+  h.build_time = index_info.build_time;
+  strncpy(h.algorithm, index_info.algorithm.c_str(), sizeof(h.algorithm)-1);
+  strncpy(h.params, index_info.params.c_str(), sizeof(h.params)-1);
+  h.starts_offset = index_page;
+  h.records_offset = (h.starts_offset + h.num_starts * sizeof(int) + index_page - 1)
+    / index_page * index_page;
+
+  std::ofstream out(outFile, std::ios::binary | std::ios::out | std::ios::trunc);
+  if (!out.is_open()) {
+    std::cout << "Error: could not open " << outFile << std::endl;
+    abort();
+  }
+  out.write((char*) &h, sizeof(h));
+  pad_to(out, index_page);
+  out.write((char*) index_info.starts.begin(), h.num_starts * sizeof(int));
+  pad_to(out, index_page);
+  out.write(G.block, G.bytes());
+  if (QP != nullptr) {
+    pad_to(out, 64);
+    h.quant_offset = out.tellp();
+    QP->write(out);
+  }
+  h.file_size = out.tellp();
+  out.close();
+
+  // checksum the file as written, then fill in the header
+  int fd = open(outFile, O_RDWR);
+  if (fd == -1) {
+    perror("write_index: open");
+    abort();
+  }
+  char* p = (char*) mmap(0, h.file_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED) {
+    perror("write_index: mmap");
+    abort();
+  }
+  h.checksum = index_checksum(p + index_page, h.file_size - index_page);
+  munmap(p, h.file_size);
+  if (pwrite(fd, &h, sizeof(h), 0) != sizeof(h)) {
+    perror("write_index");
+    abort();
+  }
+  close(fd);
+  std::cout << "Wrote index " << outFile << " (" << h.file_size << " bytes) in "
+	    << t.next_time() << std::endl;
+}
+
+// reads the header of an index file, checking that it is one
+inline index_header read_index_header(char const* file) {
+  index_header h;
+  std::ifstream in(file, std::ios::binary);
+  if (!in.read((char*) &h, sizeof(h)) || memcmp(h.magic, index_magic, 8) != 0) {
+    std::cout << "Error: " << file << " is not an index file" << std::endl;
+    abort();
+  }
+  if (h.version != index_version) {
+    std::cout << "Error: index file version " << h.version << ", expected "
+	      << index_version << std::endl;
+    abort();
+  }
+  return h;
+}
+
+// An index file mapped into memory.  The points, their neighbors and the
+// flat graph all point into the mapping; only the quantized points, if
+// any, are copied out.  hints is a comma separated list of
+//   random    : madvise(MADV_RANDOM), no read ahead
+//   willneed  : madvise(MADV_WILLNEED), start reading the whole file
+//   hugepage  : madvise(MADV_HUGEPAGE) on the records
+//   populate  : map with MAP_POPULATE, i.e. read the file before serving
+//   noverify  : skip the checksum, which reads the whole file
+template<typename T>
+struct mapped_index {
+  index_header h;
+  char* base;
+  parlay::sequence<Tvec_point<T>> points;
+  parlay::sequence<Tvec_point<T>*> v;
+  std::unique_ptr<flat_graph<T>> G;
+  std::unique_ptr<quantized_points<T>> QP;
+  parlay::sequence<int> starts;
+
+  // checks that the file is as long as the header says and that every
+  // section lies inside it, so a truncated file is reported rather than
+  // faulting when it is read
+  void check_layout(char const* file, int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+      perror("fstat");
+      abort();
+    }
+    auto fail = [&] (char const* what) {
+      std::cout << "Error: " << file << " is truncated or corrupt (" << what << ")" << std::endl;
+      abort();
+    };
+    uint64_t size = st.st_size;
+    // [off, off + len) lies inside the file, without overflowing
+    auto inside = [&] (uint64_t off, uint64_t len) {return off <= size && len <= size - off;};
+    if (size != h.file_size) fail("file size");
+    if (size < index_page) fail("header");
+    if (h.coord_offset < (h.maxDeg + 1ul) * sizeof(int) ||
+	h.stride < h.coord_offset || h.d > (h.stride - h.coord_offset) / sizeof(T))
+      fail("record layout");
+    if (h.n > 0 && h.n > (size - std::min(size, h.records_offset)) / h.stride) fail("records");
+    if (!inside(h.records_offset, h.n * h.stride)) fail("records");
+    if (!inside(h.starts_offset, h.num_starts * (uint64_t) sizeof(int))) fail("start points");
+    if (h.quant_offset != 0 &&
+	(h.quant_offset < h.records_offset + h.n * h.stride || h.quant_offset >= size))
+      fail("quantization");
+  }
+
+  mapped_index(char const* file, std::string hints) {
+    parlay::internal::timer t;
+    auto has = [&] (std::string x) {return ("," + hints + ",").find("," + x + ",") != std::string::npos;};
+    h = read_index_header(file);
+    if (h.type != index_type<T>()) {
+      std::cout << "Error: index holds " << index_type_name(h.type) << " points" << std::endl;
+      abort();
+    }
+    int fd = open(file, O_RDONLY);
+    if (fd == -1) {
+      perror("open");
+      abort();
+    }
+    check_layout(file, fd);
+    int flags = MAP_SHARED | (has("populate") ? MAP_POPULATE : 0);
+    base = (char*) mmap(0, h.file_size, PROT_READ, flags, fd, 0);
+    if (base == MAP_FAILED) {
+      perror("mmap");
+      abort();
+    }
+    close(fd);
+    if (has("random")) madvise(base, h.file_size, MADV_RANDOM);
+    if (has("willneed")) madvise(base, h.file_size, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+    if (has("hugepage")) madvise(base + h.records_offset, h.n * h.stride, MADV_HUGEPAGE);
+#endif
+    if (!has("noverify")) {
+      uint64_t c = index_checksum(base + index_page, h.file_size - index_page);
+      if (c != h.checksum) {
+	std::cout << "Error: checksum mismatch in " << file << ", the index is corrupt" << std::endl;
+	abort();
+      }
+    }
+
+    G = std::make_unique<flat_graph<T>>(base + h.records_offset, h.n, h.d, h.maxDeg,
+					h.stride, h.coord_offset);
+    points = parlay::sequence<Tvec_point<T>>(h.n);
+    parlay::parallel_for(0, h.n, [&] (size_t i) {
+      points[i].id = i;
+      points[i].coordinates = parlay::make_slice(G->coordinates(i), G->coordinates(i) + h.d);
+      points[i].out_nbh = parlay::make_slice(G->neighbors(i), G->neighbors(i) + h.maxDeg);
+    });
+    v = parlay::tabulate(h.n, [&] (size_t i) -> Tvec_point<T>* {return &points[i];});
+    int* s = (int*) (base + h.starts_offset);
+    starts = parlay::tabulate(h.num_starts, [&] (size_t i) {return s[i];});
+    if (!parlay::all_of(starts, [&] (int x) {return x >= 0 && (uint64_t) x < h.n;})) {
+      std::cout << "Error: start point out of range in " << file << std::endl;
+      abort();
+    }
+    if (h.quant_offset != 0) QP.reset(quantized_points<T>::read(base + h.quant_offset));
+    std::cout << "Loaded " << h.algorithm << " index with " << h.n << " " << index_type_name(h.type)
+	      << " points of dimension " << h.d << " and parameters " << h.params
+	      << " in " << t.next_time() << std::endl;
+  }
+
+  ~mapped_index() {munmap(base, h.file_size);}
+};
+
+// answers the queries in q on a saved index, without building anything
+template<typename T>
+void serve_index(char const* file, std::string hints, parlay::sequence<Tvec_point<T>> &qpoints,
+		 parlay::sequence<ivec_point> &groundTruth, char* res_file) {
+  mapped_index<T> I(file, hints);
+  auto q = parlay::tabulate(qpoints.size(), [&] (size_t i) -> Tvec_point<T>* {
+      return &qpoints[i];});
+  auto [avg_deg, max_deg] = graph_stats(I.v);
+  Graph G(I.h.algorithm, I.h.params, I.h.n, avg_deg, max_deg, I.h.build_time);
+  G.print();
+  bool random = (I.starts.size() == 0);
+  search_and_parse(G, I.v, q, groundTruth, res_file, I.h.mips != 0, random,
+		   random ? 0 : I.starts[0], I.QP.get(), I.G.get());
+}
+
+#endif
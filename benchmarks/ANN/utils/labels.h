@@ -0,0 +1,160 @@
+// This code is part of the Problem Based Benchmark Suite (PBBS)
+// Copyright (c) 2011 Guy Blelloch and the PBBS team
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights (to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef LABELS
+#define LABELS
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include "parlay/parallel.h"
+#include "parlay/primitives.h"
+
+// The label sets of a set of points (e.g. tenant or category ids), in
+// compressed sparse row form: the labels of point i are
+// labels[offsets[i]..offsets[i+1]), sorted.  On disk they use the
+// .spmat format of the big-ann filtered track:
+//   int64 rows, int64 columns (the number of labels), int64 nonzeros,
+//   int64 offsets[rows+1], int32 labels[nonzeros], float32 values[nonzeros]
+// where the values are ignored.
+struct label_sets {
+  int num_labels = 0;
+  parlay::sequence<int64_t> offsets;
+  parlay::sequence<int> labels;
+
+  label_sets() {}
+
+  // from a label set per point
+  label_sets(parlay::sequence<parlay::sequence<int>> &sets, int num_labels) : num_labels(num_labels) {
+    auto sizes = parlay::map(sets, [] (auto &s) {return (int64_t) s.size();});
+    auto [offs, total] = parlay::scan(sizes);
+    offsets = std::move(offs);
+    offsets.push_back(total);
+    labels = parlay::flatten(sets);
+    parlay::parallel_for(0, size(), [&] (size_t i) {
+      std::sort(labels.begin() + offsets[i], labels.begin() + offsets[i+1]);});
+  }
+
+  size_t size() const {return offsets.size() == 0 ? 0 : offsets.size() - 1;}
+
+  parlay::slice<int const*, int const*> of(size_t i) const {
+    return parlay::make_slice(labels.begin() + offsets[i], labels.begin() + offsets[i+1]);
+  }
+
+  bool has(size_t i, int l) const {
+    auto s = of(i);
+    return std::binary_search(s.begin(), s.end(), l);
+  }
+
+  // whether points a and b share a label
+  bool intersects(size_t a, size_t b) const {
+    auto sa = of(a), sb = of(b);
+    size_t i = 0, j = 0;
+    while (i < sa.size() && j < sb.size()) {
+      if (sa[i] == sb[j]) return true;
+      if (sa[i] < sb[j]) i++; else j++;
+    }
+    return false;
+  }
+
+  // whether every label shared by a and b is also a label of c
+  bool covers(size_t a, size_t b, size_t c) const {
+    auto sa = of(a), sb = of(b);
+    size_t i = 0, j = 0;
+    while (i < sa.size() && j < sb.size()) {
+      if (sa[i] == sb[j]) {
+	if (!has(c, sa[i])) return false;
+	i++; j++;
+      } else if (sa[i] < sb[j]) i++; else j++;
+    }
+    return true;
+  }
+
+  // the points carrying each label
+  parlay::sequence<parlay::sequence<int>> points_per_label() const {
+    auto pairs = parlay::flatten(parlay::tabulate(size(), [&] (size_t i) {
+      return parlay::map(of(i), [&] (int l) {return std::make_pair(l, (int) i);});}));
+    return parlay::group_by_index(pairs, num_labels);
+  }
+
+  void write(char const* file) const {
+    std::ofstream out(file, std::ios::binary);
+    int64_t header[3] = {(int64_t) size(), num_labels, (int64_t) labels.size()};
+    out.write((char*) header, sizeof(header));
+    out.write((char*) offsets.begin(), offsets.size() * sizeof(int64_t));
+    out.write((char*) labels.begin(), labels.size() * sizeof(int));
+    parlay::sequence<float> values(labels.size(), 1.0);
+    out.write((char*) values.begin(), values.size() * sizeof(float));
+    if (!out) {
+      std::cout << "Error: could not write labels to " << file << std::endl;
+      abort();
+    }
+  }
+
+  static label_sets read(char const* file) {
+    std::ifstream in(file, std::ios::binary);
+    int64_t header[3];
+    if (!in.read((char*) header, sizeof(header))) {
+      std::cout << "Error: could not read labels from " << file << std::endl;
+      abort();
+    }
+    if (header[0] < 0 || header[1] < 0 || header[1] > INT32_MAX || header[2] < 0) {
+      std::cout << "Error: " << file << " is not a label file" << std::endl;
+      abort();
+    }
+    label_sets L;
+    L.num_labels = header[1];
+    L.offsets = parlay::sequence<int64_t>(header[0] + 1);
+    L.labels = parlay::sequence<int>(header[2]);
+    in.read((char*) L.offsets.begin(), L.offsets.size() * sizeof(int64_t));
+    in.read((char*) L.labels.begin(), L.labels.size() * sizeof(int));
+    bool rows_ok = L.offsets[0] == 0 && L.offsets[header[0]] == header[2] &&
+      parlay::all_of(parlay::iota(header[0]), [&] (size_t i) {return L.offsets[i] <= L.offsets[i+1];});
+    if (!in || !rows_ok) {
+      std::cout << "Error: " << file << " is not a label file" << std::endl;
+      abort();
+    }
+    if (!parlay::all_of(L.labels, [&] (int l) {return l >= 0 && l < L.num_labels;})) {
+      std::cout << "Error: " << file << " has labels outside [0, " << L.num_labels << ")" << std::endl;
+      abort();
+    }
+    parlay::parallel_for(0, L.size(), [&] (size_t i) {
+      std::sort(L.labels.begin() + L.offsets[i], L.labels.begin() + L.offsets[i+1]);});
+    std::cout << "Read " << L.labels.size() << " labels of " << L.size() << " points from "
+	      << file << std::endl;
+    return L;
+  }
+};
+
+// the label of each query, which must have exactly one
+inline parlay::sequence<int> query_labels(label_sets const &L) {
+  return parlay::tabulate(L.size(), [&] (size_t i) {
+    if (L.of(i).size() != 1) {
+      std::cout << "Error: query " << i << " has " << L.of(i).size()
+		<< " labels, filtered search needs exactly one" << std::endl;
+      abort();
+    }
+    return L.of(i)[0];});
+}
+
+#endif
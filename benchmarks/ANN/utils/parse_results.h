@@ -20,6 +20,9 @@
 // OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
 // WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
+#ifndef PARSE_RESULTS
+#define PARSE_RESULTS
+
 #include <algorithm>
 #include "parlay/parallel.h"
 #include "parlay/primitives.h"
@@ -139,6 +142,48 @@ struct nn_result{
   }
 };
 
+struct serve_result{
+  double recall;
+
+  double avg_latency;
+  double p50_latency;
+  double p99_latency;
+
+  size_t avg_cmps;
+  size_t tail_cmps;
+
+  size_t avg_visited;
+  size_t tail_visited;
+
+  float QPS;
+
+  int k;
+  int beamQ;
+  float cut;
+  size_t batch;
+
+  long num_queries;
+
+  serve_result(double r, parlay::sequence<double> latency, parlay::sequence<size_t> stats, float qps,
+    int K, int Q, float c, size_t b, long q) : recall(r), QPS(qps), k(K), beamQ(Q), cut(c), batch(b),
+    num_queries(q) {
+
+    if(latency.size() != 3 || stats.size() != 4) abort();
+
+    avg_latency = latency[0]; p50_latency = latency[1]; p99_latency = latency[2];
+    avg_cmps = stats[0]; tail_cmps = stats[1];
+    avg_visited = stats[2]; tail_visited = stats[3];
+  }
+
+  void print(){
+    std::cout << "k = " << k << ", Q = " << beamQ << ", cut = " << cut << ", batch = " << batch
+	    << ": recall " << recall << ", throughput " << QPS << "/second, latency avg "
+	    << avg_latency*1e6 << " p50 " << p50_latency*1e6 << " p99 " << p99_latency*1e6 << " us" << std::endl;
+    std::cout << "  dist cmps avg " << avg_cmps << " p99 " << tail_cmps
+	    << ", hops avg " << avg_visited << " p99 " << tail_visited << std::endl;
+  }
+};
+
 struct lsh_result{
   double recall;
 
@@ -149,10 +194,11 @@ struct lsh_result{
 
   int k;
   int num_tables;
+  int probes;
   long num_queries;
 
-  lsh_result(double r, parlay::sequence<size_t> stats, float qps, int K, int n, long q) : recall(r), 
-    QPS(qps), k(K), num_tables(n), num_queries(q) {
+  lsh_result(double r, parlay::sequence<size_t> stats, float qps, int K, int n, long q, int p=1) : recall(r), 
+    QPS(qps), k(K), num_tables(n), probes(p), num_queries(q) {
 
     if(stats.size() != 2) abort();
     avg_cmps = stats[0]; tail_cmps = stats[1];
@@ -160,7 +206,7 @@ struct lsh_result{
 
   void print(){
     std::cout << "Over " << num_queries << " queries" << std::endl;
-    std::cout << "k = " << k << ", tables = " << num_tables
+    std::cout << "k = " << k << ", tables = " << num_tables << ", probes = " << probes
 	    << ", throughput = " << QPS << "/second" << std::endl;
     std::cout << "Recall: " << recall << std::endl; 
   	std::cout << "Average dist cmps: " << avg_cmps << ", 99th percentile dist cmps: " << tail_cmps << std::endl;
@@ -195,4 +241,6 @@ auto parse_result(parlay::sequence<res> results, parlay::sequence<float> buckets
     }
   }
   return std::make_pair(retval, ret_buckets);
-}
\ No newline at end of file
+}
+
+#endif
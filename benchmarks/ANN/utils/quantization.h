@@ -0,0 +1,329 @@
+// This code is part of the Problem Based Benchmark Suite (PBBS)
+// Copyright (c) 2011 Guy Blelloch and the PBBS team
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights (to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef QUANTIZATION
+#define QUANTIZATION
+
+#include <algorithm>
+#include <cstring>
+#include <ostream>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <vector>
+#include "parlay/parallel.h"
+#include "parlay/primitives.h"
+#include "parlay/random.h"
+#include "types.h"
+#include "NSGDist.h"
+
+// Compressed copies of the points, used in place of the exact
+// coordinates to traverse the graph.  Two methods are supported:
+//
+//  sq8 : each coordinate is stored as one byte, (x - lo[j])/scale,
+//        with a per dimension offset lo[j] and a single scale, so that
+//        distances between codes are distances between points up to
+//        the factor scale^2 and can use the uint8 kernels.  Queries are
+//        encoded the same way.
+//
+//  pq  : the dimensions are split into M subspaces, each with 256
+//        centroids found by k-means on a sample, and a point is stored
+//        as the index of its nearest centroid in each subspace (M
+//        bytes).  The distance from a query to a point is the sum of M
+//        entries of a table computed once per query, and the distance
+//        between two points the sum of M entries of precomputed
+//        centroid to centroid tables.
+//
+// Distances are approximate, so the results of a search should be
+// re-ranked on the exact coordinates (see rerank in beamSearch.h).
+template<typename T>
+struct quantized_points {
+  enum method {sq8, pq};
+  static constexpr int K = 256;  // centroids per subspace
+
+  method type;
+  unsigned d;
+  bool mips;
+  size_t n;
+  size_t code_size;                   // bytes per point
+  parlay::sequence<uint8_t> codes;    // code_size bytes for each point
+
+  // sq8
+  parlay::sequence<float> lo;
+  float scale;
+  float lolo;                         // lo . lo
+  parlay::sequence<float> bias;       // scale * (lo . code) for each point, if mips
+
+  // pq
+  unsigned M;
+  parlay::sequence<unsigned> sub_start;  // M+1 boundaries of the subspaces
+  parlay::sequence<float> centroids;     // K centroids of subspace m at K*sub_start[m]
+  parlay::sequence<float> sdc;           // K*K centroid distances per subspace
+
+  // per query state, one per search
+  struct query {
+    std::vector<uint8_t> code;
+    float bias;
+    std::vector<float> table;
+  };
+
+  static method parse_method(std::string const &s) {
+    if (s == "sq8") return sq8;
+    if (s == "pq") return pq;
+    std::cout << "Error: unknown quantization " << s << ", use sq8 or pq" << std::endl;
+    abort();
+  }
+
+  quantized_points() {}
+
+  quantized_points(parlay::sequence<Tvec_point<T>*> &v, method t, unsigned subspaces, bool m)
+    : type(t), d(v[0]->coordinates.size()), mips(m), n(v.size()) {
+    if (type == sq8) build_sq8(v);
+    else build_pq(v, subspaces == 0 ? std::max(1u, d/4) : std::min(subspaces, d));
+  }
+
+  size_t bytes_per_point() const {return code_size + (mips && type == sq8 ? sizeof(float) : 0);}
+
+  uint8_t const* code(size_t i) const {return codes.begin() + i * code_size;}
+
+  // partial distance between two float vectors of length l
+  float sub_distance(float const* a, float const* b, unsigned l) const {
+    float r = 0;
+    if (mips) for (unsigned i = 0; i < l; i++) r -= a[i] * b[i];
+    else for (unsigned i = 0; i < l; i++) {float x = a[i] - b[i]; r += x * x;}
+    return r;
+  }
+
+  // ******************** sq8 ********************
+
+  uint8_t sq8_encode(float x, unsigned j) const {
+    float c = std::round((x - lo[j]) / scale);
+    return (uint8_t) std::min(255.0f, std::max(0.0f, c));
+  }
+
+  void build_sq8(parlay::sequence<Tvec_point<T>*> &v) {
+    code_size = d;
+    lo = parlay::tabulate(d, [&] (size_t j) {
+	return (float) parlay::reduce(parlay::delayed_seq<float>(n, [&] (size_t i) {
+	      return (float) v[i]->coordinates[j];}), parlay::minm<float>());});
+    auto hi = parlay::tabulate(d, [&] (size_t j) {
+	return (float) parlay::reduce(parlay::delayed_seq<float>(n, [&] (size_t i) {
+	      return (float) v[i]->coordinates[j];}), parlay::maxm<float>());});
+    float range = parlay::reduce(parlay::delayed_seq<float>(d, [&] (size_t j) {
+	  return hi[j] - lo[j];}), parlay::maxm<float>());
+    scale = (range > 0) ? range / 255 : 1.0;
+    lolo = 0;
+    for (unsigned j = 0; j < d; j++) lolo += lo[j] * lo[j];
+    codes = parlay::sequence<uint8_t>(n * d);
+    parlay::parallel_for(0, n, [&] (size_t i) {
+      for (unsigned j = 0; j < d; j++)
+	codes[i * d + j] = sq8_encode((float) v[i]->coordinates[j], j);
+    });
+    if (mips)
+      bias = parlay::tabulate(n, [&] (size_t i) {return code_bias(code(i));});
+  }
+
+  float code_bias(uint8_t const* c) const {
+    float r = 0;
+    for (unsigned j = 0; j < d; j++) r += lo[j] * c[j];
+    return scale * r;
+  }
+
+  // -(approximate inner product) given the inner product of the codes
+  float sq8_mips(float code_ip, float bias_a, float bias_b) const {
+    return -(lolo + bias_a + bias_b + scale * scale * code_ip);
+  }
+
+  // ******************** pq ********************
+
+  unsigned sub_dim(unsigned m) const {return sub_start[m+1] - sub_start[m];}
+  float const* centroid(unsigned m, int c) const {
+    return centroids.begin() + K * sub_start[m] + c * sub_dim(m);}
+
+  int nearest_centroid(float const* x, unsigned m) const {
+    int best = 0;
+    float best_d = std::numeric_limits<float>::max();
+    for (int c = 0; c < K; c++) {
+      float dd = 0;
+      float const* y = centroid(m, c);
+      for (unsigned i = 0; i < sub_dim(m); i++) {float z = x[i] - y[i]; dd += z * z;}
+      if (dd < best_d) {best_d = dd; best = c;}
+    }
+    return best;
+  }
+
+  void build_pq(parlay::sequence<Tvec_point<T>*> &v, unsigned subspaces) {
+    M = subspaces;
+    code_size = M;
+    sub_start = parlay::tabulate(M + 1, [&] (size_t m) {return (unsigned) (m * d / M);});
+
+    // train on a random sample, converted to float
+    size_t ns = std::min<size_t>(n, K * 64);
+    auto perm = parlay::random_permutation<int>(static_cast<int>(n));
+    parlay::sequence<float> sample(ns * d);
+    parlay::parallel_for(0, ns, [&] (size_t i) {
+      for (unsigned j = 0; j < d; j++) sample[i * d + j] = (float) v[perm[i]]->coordinates[j];
+    });
+
+    // k-means (Lloyd's) on each subspace, starting from sample points
+    centroids = parlay::sequence<float>(K * d, 0.0);
+    parlay::sequence<int> assign(ns);
+    for (unsigned m = 0; m < M; m++) {
+      unsigned s = sub_start[m], l = sub_dim(m);
+      for (int c = 0; c < K; c++)
+	for (unsigned i = 0; i < l; i++)
+	  centroids[K * s + c * l + i] = sample[(c % ns) * d + s + i];
+      for (int iter = 0; iter < 10; iter++) {
+	parlay::parallel_for(0, ns, [&] (size_t i) {
+	  assign[i] = nearest_centroid(sample.begin() + i * d + s, m);});
+	std::vector<double> sum(K * l, 0.0);
+	std::vector<size_t> cnt(K, 0);
+	for (size_t i = 0; i < ns; i++) {
+	  cnt[assign[i]]++;
+	  for (unsigned j = 0; j < l; j++) sum[assign[i] * l + j] += sample[i * d + s + j];
+	}
+	for (int c = 0; c < K; c++)
+	  for (unsigned j = 0; j < l; j++)
+	    centroids[K * s + c * l + j] = (cnt[c] > 0) ? sum[c * l + j] / cnt[c]
+	      : sample[((c * 7919 + iter) % ns) * d + s + j];
+      }
+    }
+
+    codes = parlay::sequence<uint8_t>(n * M);
+    parlay::parallel_for(0, n, [&] (size_t i) {
+      std::vector<float> x(d);
+      for (unsigned j = 0; j < d; j++) x[j] = (float) v[i]->coordinates[j];
+      for (unsigned m = 0; m < M; m++)
+	codes[i * M + m] = (uint8_t) nearest_centroid(x.data() + sub_start[m], m);
+    });
+
+    sdc = parlay::sequence<float>((size_t) M * K * K);
+    parlay::parallel_for(0, (size_t) M * K, [&] (size_t mc) {
+      unsigned m = mc / K;
+      int a = mc % K;
+      for (int b = 0; b < K; b++)
+	sdc[mc * K + b] = sub_distance(centroid(m, a), centroid(m, b), sub_dim(m));
+    });
+  }
+
+  // ******************** saving ********************
+
+  template<typename E>
+  static void write_seq(std::ostream &out, parlay::sequence<E> const &s) {
+    uint64_t l = s.size();
+    out.write((char*) &l, sizeof(l));
+    out.write((char*) s.begin(), l * sizeof(E));
+  }
+
+  template<typename E>
+  static parlay::sequence<E> read_seq(char const* &p) {
+    uint64_t l;
+    memcpy(&l, p, sizeof(l));
+    p += sizeof(l);
+    parlay::sequence<E> s(l);
+    memcpy((char*) s.begin(), p, l * sizeof(E));
+    p += l * sizeof(E);
+    return s;
+  }
+
+  // writes the state to out, to be read back by read
+  void write(std::ostream &out) const {
+    uint64_t f[6] = {(uint64_t) type, d, mips, n, code_size, (type == pq) ? M : 0};
+    float c[2] = {scale, lolo};
+    out.write((char*) f, sizeof(f));
+    out.write((char*) c, sizeof(c));
+    write_seq(out, codes); write_seq(out, lo); write_seq(out, bias);
+    write_seq(out, sub_start); write_seq(out, centroids); write_seq(out, sdc);
+  }
+
+  static quantized_points* read(char const* p) {
+    quantized_points* Q = new quantized_points();
+    uint64_t f[6];
+    float c[2];
+    memcpy(f, p, sizeof(f)); p += sizeof(f);
+    memcpy(c, p, sizeof(c)); p += sizeof(c);
+    Q->type = (method) f[0]; Q->d = f[1]; Q->mips = f[2]; Q->n = f[3];
+    Q->code_size = f[4]; Q->M = f[5];
+    Q->scale = c[0]; Q->lolo = c[1];
+    Q->codes = read_seq<uint8_t>(p); Q->lo = read_seq<float>(p); Q->bias = read_seq<float>(p);
+    Q->sub_start = read_seq<unsigned>(p); Q->centroids = read_seq<float>(p); Q->sdc = read_seq<float>(p);
+    return Q;
+  }
+
+  // ******************** distances ********************
+
+  void prepare(T const* q, query &s) const {
+    if (type == sq8) {
+      s.code.resize(d);
+      for (unsigned j = 0; j < d; j++) s.code[j] = sq8_encode((float) q[j], j);
+      s.bias = mips ? code_bias(s.code.data()) : 0;
+    } else {
+      static thread_local std::vector<float> x;
+      x.resize(d);
+      for (unsigned j = 0; j < d; j++) x[j] = (float) q[j];
+      s.table.resize(M * K);
+      for (unsigned m = 0; m < M; m++)
+	for (int c = 0; c < K; c++)
+	  s.table[m * K + c] = sub_distance(x.data() + sub_start[m], centroid(m, c), sub_dim(m));
+    }
+  }
+
+  // approximate distances from the query to the points ids[0..m)
+  void distances(query const &s, int const* ids, size_t m, float* out) const {
+    if (type == sq8) {
+      // reused across calls, as this runs on every hop of a search
+      static thread_local std::vector<uint8_t const*> ptrs;
+      if (ptrs.size() < m) ptrs.resize(m);
+      for (size_t j = 0; j < m; j++) ptrs[j] = code(ids[j]);
+      if (mips) {
+	ann_simd::active<uint8_t>.ip_batch(s.code.data(), ptrs.data(), m, d, out);
+	for (size_t j = 0; j < m; j++) out[j] = sq8_mips(out[j], s.bias, bias[ids[j]]);
+      } else {
+	ann_simd::active<uint8_t>.l2_batch(s.code.data(), ptrs.data(), m, d, out);
+	for (size_t j = 0; j < m; j++) out[j] *= scale * scale;
+      }
+    } else {
+      for (size_t j = 0; j + 1 < m; j++) __builtin_prefetch(code(ids[j + 1]));
+      for (size_t j = 0; j < m; j++) {
+	uint8_t const* c = code(ids[j]);
+	float r = 0;
+	for (unsigned l = 0; l < M; l++) r += s.table[l * K + c[l]];
+	out[j] = r;
+      }
+    }
+  }
+
+  // approximate distance between the points a and b
+  float distance(int a, int b) const {
+    if (type == sq8) {
+      if (mips) return sq8_mips(ann_simd::active<uint8_t>.ip(code(a), code(b), d), bias[a], bias[b]);
+      return scale * scale * ann_simd::active<uint8_t>.l2(code(a), code(b), d);
+    }
+    uint8_t const* ca = code(a);
+    uint8_t const* cb = code(b);
+    float r = 0;
+    for (unsigned m = 0; m < M; m++) r += sdc[((size_t) m * K + ca[m]) * K + cb[m]];
+    return r;
+  }
+};
+
+#endif
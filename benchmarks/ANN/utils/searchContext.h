@@ -0,0 +1,181 @@
+// This code is part of the Problem Based Benchmark Suite (PBBS)
+// Copyright (c) 2011 Guy Blelloch and the PBBS team
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights (to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef SEARCHCONTEXT
+#define SEARCHCONTEXT
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+#include "parlay/sequence.h"
+#include "parlay/utilities.h"
+
+using pid = std::pair<int, float>;
+
+// The scratch state of one beam search, kept by each worker thread and
+// reused across searches, so that a search does no allocation once the
+// buffers have grown to the largest beam and degree used:
+//
+//  - the beam is a sorted array bounded by the beam size, with a flag
+//    per entry for whether it has been expanded and a cursor to the
+//    closest unexpanded entry,
+//  - the points whose distance has been computed are remembered in a
+//    direct mapped table (as in the original search, a collision just
+//    means a distance may be computed twice), tagged by the number of
+//    the search so that it never has to be cleared,
+//  - candidates, their distances and the expanded points go into
+//    buffers that are only cleared.
+//
+// All loops are sequential; queries are run in parallel with each other.
+struct search_context {
+  struct entry {
+    int id;
+    float dist;
+    bool expanded;
+  };
+
+  std::vector<entry> beam;
+  size_t beam_size = 0;   // entries in use
+  size_t cursor = 0;      // first unexpanded entry
+  std::vector<int> table_id;
+  std::vector<uint32_t> table_epoch;
+  uint32_t epoch = 0;
+  uint64_t mask = 0;
+  std::vector<int> candidates;
+  std::vector<float> dists;
+  std::vector<pid> visited;   // in order of expansion
+  size_t dist_cmps = 0;
+
+  // the context of the calling worker
+  static search_context& local() {
+    static thread_local search_context ctx;
+    return ctx;
+  }
+
+  void reset(int beamSize, size_t maxDeg) {
+    if (beam.size() < (size_t) beamSize) beam.resize(beamSize);
+    int bits = std::max(4, (int) std::ceil(std::log2((double) beamSize*beamSize))-2);
+    if (table_id.size() < ((size_t) 1 << bits)) {
+      table_id.assign((size_t) 1 << bits, -1);
+      table_epoch.assign((size_t) 1 << bits, 0);
+      mask = ((uint64_t) 1 << bits) - 1;
+    }
+    if (++epoch == 0) {  // wrapped around
+      std::fill(table_epoch.begin(), table_epoch.end(), 0);
+      epoch = 1;
+    }
+    if (candidates.size() < maxDeg) {candidates.resize(maxDeg); dists.resize(maxDeg);}
+    beam_size = 0;
+    cursor = 0;
+    visited.clear();
+    dist_cmps = 0;
+  }
+
+  // true the first time it is called on a (since reset) for a in the table
+  bool first_seen(int a) {
+    size_t loc = parlay::hash64_2(a) & mask;
+    if (table_epoch[loc] == epoch && table_id[loc] == a) return false;
+    table_epoch[loc] = epoch;
+    table_id[loc] = a;
+    return true;
+  }
+
+  static bool less(entry const &a, int id, float dist) {
+    return a.dist < dist || (a.dist == dist && a.id < id);
+  }
+
+  // adds a point to the beam, unless it is already there or the beam is
+  // full of closer points
+  void insert(int id, float dist, size_t capacity) {
+    if (beam_size == capacity && less(beam[beam_size-1], id, dist)) return;
+    size_t lo = 0, hi = beam_size;
+    while (lo < hi) {
+      size_t mid = (lo + hi) / 2;
+      if (less(beam[mid], id, dist)) lo = mid + 1; else hi = mid;
+    }
+    if (lo < beam_size && beam[lo].id == id) return;
+    size_t end = std::min(beam_size, capacity - 1);
+    std::memmove(beam.data() + lo + 1, beam.data() + lo, (end - lo) * sizeof(entry));
+    beam[lo] = entry{id, dist, false};
+    beam_size = end + 1;
+    if (lo < cursor) cursor = lo;
+  }
+
+  // the visited points, sorted by distance
+  parlay::sequence<pid> sorted_visited() const {
+    parlay::sequence<pid> r(visited.begin(), visited.end());
+    std::sort(r.begin(), r.end(), [&] (pid a, pid b) {
+	return a.second < b.second || (a.second == b.second && a.first < b.first);});
+    return r;
+  }
+
+  // Beam search from the points starts[0..ns).  nbrs(i) returns a
+  // pointer to the neighbors of point i and their number, dist(ids, m,
+  // out) the distances from the query to the points ids[0..m), and pre(i)
+  // is called on the next point to be expanded before its turn comes,
+  // e.g. to prefetch it.  Points equal to exclude are skipped.  Once the
+  // beam holds more than k points it is cut to the points within cut
+  // times the distance of the (k+1)-th closest.  At most limit points are
+  // expanded.
+  template<class Nbrs, class Dist, class Pre>
+  void search(int const* starts, size_t ns, Nbrs&& nbrs, Dist&& dist, Pre&& pre,
+	      int beamSize, size_t maxDeg, bool mips, int k=0, float cut=1.14,
+	      long limit=-1, int exclude=-1) {
+    reset(beamSize, std::max(maxDeg, ns));
+    size_t m = 0;
+    for (size_t i = 0; i < ns; i++)
+      if (first_seen(starts[i])) candidates[m++] = starts[i];
+    dist(candidates.data(), m, dists.data());
+    dist_cmps += m;
+    for (size_t j = 0; j < m; j++) insert(candidates[j], dists[j], beamSize);
+
+    while (cursor < beam_size && (limit < 0 || (long) visited.size() < limit)) {
+      entry &current = beam[cursor];
+      current.expanded = true;
+      visited.push_back(pid(current.id, current.dist));
+      auto [nbh, deg] = nbrs(current.id);
+      while (cursor < beam_size && beam[cursor].expanded) cursor++;
+      m = 0;
+      for (int j = 0; j < deg; j++) {
+	int a = nbh[j];
+	if (a != exclude && first_seen(a)) candidates[m++] = a;
+      }
+      dist(candidates.data(), m, dists.data());
+      dist_cmps += m;
+      for (size_t j = 0; j < m; j++) insert(candidates[j], dists[j], beamSize);
+      if (k > 0 && beam_size > (size_t) k) {
+	float bound = mips ? -cut * beam[k].dist : cut * beam[k].dist;
+	size_t b = k;
+	while (b < beam_size && beam[b].dist <= bound) b++;
+	beam_size = b;
+	cursor = std::min(cursor, beam_size);
+      }
+      while (cursor < beam_size && beam[cursor].expanded) cursor++;
+      if (cursor < beam_size) pre(beam[cursor].id);
+    }
+  }
+};
+
+#endif
@@ -20,6 +20,9 @@
 // OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
 // WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
+#ifndef STATS
+#define STATS
+
 #include <algorithm>
 #include "parlay/parallel.h"
 #include "parlay/primitives.h"
@@ -95,6 +98,16 @@ parlay::sequence<size_t> rounds_stats(parlay::sequence<Tvec_point<T>*> &q){
 	return result;
 }
 
+//average, median and 99th percentile of a set of latencies
+parlay::sequence<double> latency_stats(parlay::sequence<double> latencies){
+	parlay::sort_inplace(latencies);
+	double avg = parlay::reduce(latencies)/((double) latencies.size());
+	double median = latencies[latencies.size()/2];
+	size_t tail_index = .99*((float) latencies.size());
+	auto result = {avg, median, latencies[tail_index]};
+	return result;
+}
+
 void range_gt_stats(parlay::sequence<ivec_point> groundTruth){
   auto sizes = parlay::tabulate(groundTruth.size(), [&] (size_t i) {return groundTruth[i].coordinates.size();});
   parlay::sort_inplace(sizes);
@@ -110,3 +123,4 @@ void range_gt_stats(parlay::sequence<ivec_point> groundTruth){
   std::cout << "Max: " << nonzero_sizes[nonzero_sizes.size()-1] << std::endl;
 }
 
+#endif
@@ -0,0 +1,81 @@
+// This code is part of the Problem Based Benchmark Suite (PBBS)
+// Copyright (c) 2011 Guy Blelloch and the PBBS team
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights (to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef TOMBSTONES
+#define TOMBSTONES
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include "parlay/parallel.h"
+#include "parlay/primitives.h"
+
+// The set of points deleted from an index but not yet removed from its
+// graph, as a bitmap with one bit per point.  Points can be added and
+// tested concurrently from parallel loops; resize and clear cannot run
+// concurrently with anything else.
+struct tombstone_set {
+  std::vector<std::atomic<uint64_t>> words;
+  std::atomic<size_t> count{0};
+
+  size_t capacity() const {return words.size() * 64;}
+  size_t size() const {return count.load();}
+
+  // grows the bitmap to hold the points 0..n-1, keeping its contents
+  void resize(size_t n) {
+    size_t m = (n + 63) / 64;
+    if (m <= words.size()) return;
+    std::vector<std::atomic<uint64_t>> w(m);
+    parlay::parallel_for(0, m, [&] (size_t i) {
+      w[i] = (i < words.size()) ? words[i].load() : 0;});
+    words.swap(w);
+  }
+
+  // adds i, returning false if it was already there
+  bool insert(int i) {
+    uint64_t b = uint64_t(1) << (i & 63);
+    if (words[i >> 6].fetch_or(b) & b) return false;
+    count++;
+    return true;
+  }
+
+  bool contains(int i) const {
+    return (size_t) i < capacity() && (words[i >> 6].load(std::memory_order_relaxed) >> (i & 63)) & 1;
+  }
+
+  // the points in the set, in increasing order
+  parlay::sequence<int> members() const {
+    auto ids = parlay::tabulate(words.size(), [&] (size_t i) {
+      parlay::sequence<int> r;
+      for (uint64_t w = words[i].load(); w != 0; w &= w - 1)
+	r.push_back(i * 64 + __builtin_ctzll(w));
+      return r;});
+    return parlay::flatten(ids);
+  }
+
+  void clear() {
+    parlay::parallel_for(0, words.size(), [&] (size_t i) {words[i] = 0;});
+    count = 0;
+  }
+};
+
+#endif
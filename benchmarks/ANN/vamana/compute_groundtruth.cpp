@@ -1,68 +1,174 @@
 #include <iostream>
 #include <algorithm>
+#include <fstream>
+#include <limits>
+#include <vector>
 #include "parlay/parallel.h"
 #include "parlay/primitives.h"
 #include "parlay/io.h"
 #include "../utils/types.h"
 #include "../utils/NSGDist.h"
 #include "../utils/parse_files.h"
+#include "../utils/labels.h"
 
 using pid = std::pair<int, float>;
 
+// Reads the points of a base file a chunk at a time into a contiguous
+// buffer, so that the base set never has to be in memory at once.  bin
+// files start with the number of points and the dimension, vec files
+// store the dimension before every point.
 template<typename T>
-float mips_distance(T* p, T* q, unsigned d){
-  // std::cout << "here1" << std::endl;
-  float result = 0;
-  for(int i=0; i<d; i++){
-    float a = *(p+i);
-    float b = *(q+i);
-    result -= a*b;
+struct base_reader {
+  std::ifstream in;
+  bool vec;
+  size_t n;
+  unsigned d;
+  size_t read = 0;
+
+  base_reader(const char* filename, bool vec) : in(filename, std::ios::binary), vec(vec) {
+    if (!in) {
+      std::cout << "Error: could not open " << filename << std::endl;
+      abort();
+    }
+    int header[2];
+    in.read((char*) header, vec ? sizeof(int) : 2 * sizeof(int));
+    if (vec) {
+      d = header[0];
+      in.seekg(0, std::ios::end);
+      n = in.tellg() / (sizeof(int) + d * sizeof(T));
+      in.seekg(0);
+    } else {
+      n = header[0];
+      d = header[1];
+    }
   }
-  // std::cout << "here" << std::endl; 
-  return result;
-}
 
+  // reads the next (at most) m points into buf and returns their number
+  size_t next(parlay::sequence<T> &buf, size_t m) {
+    m = std::min(m, n - read);
+    buf.resize(m * d);
+    if (vec) {
+      for (size_t i = 0; i < m; i++) {
+        int dim;
+        in.read((char*) &dim, sizeof(int));
+        in.read((char*) (buf.begin() + i * d), d * sizeof(T));
+      }
+    } else in.read((char*) buf.begin(), m * d * sizeof(T));
+    if (!in) {
+      std::cout << "Error: base file ended after " << read << " points" << std::endl;
+      abort();
+    }
+    read += m;
+    return m;
+  }
+};
+
+// The k closest points seen so far for each query, as a max-heap of k
+// entries per query that starts out full of (-1, max) entries, so that
+// a point is added by replacing the root and sifting it down, without a
+// separate case for a heap that is not full yet.
+struct topk_heaps {
+  size_t k;
+  parlay::sequence<pid> h;
+
+  topk_heaps(size_t q, size_t k)
+    : k(k), h(q * k, std::make_pair(-1, std::numeric_limits<float>::max())) {}
+
+  static bool greater(pid a, pid b) {
+    return a.second > b.second || (a.second == b.second && a.first > b.first);
+  }
+
+  float bound(size_t i) const {return h[i * k].second;}
+
+  void add(size_t i, pid p) {
+    pid* a = h.begin() + i * k;
+    if (!greater(a[0], p)) return;
+    size_t j = 0;
+    while (true) {
+      size_t c = 2 * j + 1;
+      if (c >= k) break;
+      c += (c + 1 < k && greater(a[c + 1], a[c]));
+      if (!greater(a[c], p)) break;
+      a[j] = a[c];
+      j = c;
+    }
+    a[j] = p;
+  }
+
+  parlay::sequence<parlay::sequence<pid>> results() const {
+    return parlay::tabulate(h.size() / k, [&] (size_t i) {
+      return parlay::to_sequence(h.cut(i * k, (i + 1) * k));});
+  }
+};
+
+// Exact k nearest neighbors of the queries Q among the points of the base
+// file.  The base file is read in chunks; within a chunk, blocks of
+// queries are processed in parallel, each going over the chunk a tile
+// of base points at a time (small enough to stay in the L2 cache while
+// every query in the block is compared to it) with the vectorized batch
+// distance kernels.
+//
+//if BL is given, only the points of B carrying the label of the query in
+//QL are considered, and queries with fewer than k of them are padded
+//with id -1
 template<typename T>
-parlay::sequence<parlay::sequence<pid>> compute_groundtruth(parlay::sequence<Tvec_point<T>> &B, 
-  parlay::sequence<Tvec_point<T>> &Q, int k, bool mips=false){
-    unsigned d = (B[0].coordinates).size();
+parlay::sequence<parlay::sequence<pid>> compute_groundtruth(const char* base_file, bool vec,
+  parlay::sequence<Tvec_point<T>> &Q, int k, bool mips=false,
+  label_sets const* BL=nullptr, parlay::sequence<int> const* QL=nullptr){
+    base_reader<T> B(base_file, vec);
+    unsigned d = B.d;
     size_t q = Q.size();
-    size_t b = B.size();
-    auto answers = parlay::tabulate(q, [&] (size_t i){  
-        float topdist = 0;
-        if(mips) topdist = -std::numeric_limits<float>::max();     
-        int toppos;
-        parlay::sequence<pid> topk;
-        for(size_t j=0; j<b; j++){
-            float dist;
-            if(mips) dist = mips_distance<T>((Q[i].coordinates).begin(), (B[j].coordinates).begin(), d);
-            else dist = distance((Q[i].coordinates).begin(), (B[j].coordinates).begin(), d);
-            if(topk.size() < k){
-                if(dist > topdist){
-                    topdist = dist;   
-                    toppos = topk.size();
-                }
-                topk.push_back(std::make_pair((int) j, dist));
-            }
-            else if(dist < topdist){
-                float new_topdist=0;
-                if(mips) new_topdist = -std::numeric_limits<float>::max();   
-                int new_toppos=0;
-                topk[toppos] = std::make_pair((int) j, dist);
-                for(size_t l=0; l<topk.size(); l++){
-                    if(topk[l].second > new_topdist){
-                        new_topdist = topk[l].second;
-                        new_toppos = (int) l;
+    std::cout << "Base file size " << B.n << std::endl;
+    if(Q[0].coordinates.size() != d){
+      std::cout << "Error: queries of dimension " << Q[0].coordinates.size()
+                << " for points of dimension " << d << std::endl;
+      abort();
+    }
+    if(QL != nullptr && QL->size() != q){
+      std::cout << "Error: " << QL->size() << " query labels for " << q << " queries" << std::endl;
+      abort();
+    }
+    size_t point_bytes = d * sizeof(T);
+    size_t chunk = std::max<size_t>(1, (size_t(256) << 20) / point_bytes);
+    size_t tile = std::max<size_t>(64, (size_t(256) << 10) / point_bytes);
+    size_t qblock = std::clamp<size_t>(q / (4 * parlay::num_workers()), 1, 16);
+    size_t num_qblocks = (q + qblock - 1) / qblock;
+
+    topk_heaps top(q, k);
+    parlay::sequence<T> buf;
+    parlay::internal::timer t;
+    size_t offset = 0;
+    while(offset < B.n){
+        size_t m = B.next(buf, chunk);
+        parlay::parallel_for(0, num_qblocks, [&] (size_t qb) {
+            static thread_local std::vector<T const*> pts;
+            static thread_local std::vector<float> dists;
+            pts.resize(tile);
+            dists.resize(tile);
+            size_t qe = std::min(q, (qb + 1) * qblock);
+            for(size_t j0 = 0; j0 < m; j0 += tile){
+                size_t tm = std::min(tile, m - j0);
+                for(size_t j = 0; j < tm; j++) pts[j] = buf.begin() + (j0 + j) * d;
+                for(size_t i = qb * qblock; i < qe; i++){
+                    distance_batch<T>(Q[i].coordinates.begin(), pts.data(), tm, d, dists.data(), mips);
+                    float bound = top.bound(i);
+                    for(size_t j = 0; j < tm; j++){
+                        if(dists[j] > bound) continue;
+                        int id = static_cast<int>(offset + j0 + j);
+                        if(BL != nullptr && !BL->has(id, (*QL)[i])) continue;
+                        top.add(i, std::make_pair(id, dists[j]));
+                        bound = top.bound(i);
                     }
                 }
-                topdist = new_topdist;
-                toppos = new_toppos;
             }
-        }
-        return topk;
-    });
-    std::cout << "Done computing groundtruth" << std::endl;
-    return answers;
+        }, 1);
+        offset += m;
+        std::cout << "Processed " << offset << " of " << B.n << " points" << std::endl;
+    }
+    double time = t.next_time();
+    std::cout << "Done computing groundtruth in " << time << " seconds ("
+              << (double) q * B.n / time << " distances/second, " << distance_isa<T>() << ")" << std::endl;
+    return top.results();
 }
 
 void write_ivecs(parlay::sequence<parlay::sequence<pid>> &result, const std::string outFile, int k){
@@ -132,10 +238,22 @@ void write_ibin(parlay::sequence<parlay::sequence<pid>> &result, const std::stri
 
 
 int main(int argc, char* argv[]) {
-  if (argc != 8) {
-    std::cout << "usage: compute_groundtruth <base> <query> <filetype> <vectype> <k> <mips> <oFile>" << std::endl;
+  if (argc != 8 && argc != 10) {
+    std::cout << "usage: compute_groundtruth <base> <query> <filetype> <vectype> <k> <mips> <oFile> "
+              << "[<base labels> <query labels>]" << std::endl;
     return 1;
   }
+  label_sets base_labels;
+  parlay::sequence<int> query_label;
+  label_sets* BL = nullptr;
+  parlay::sequence<int>* QL = nullptr;
+  if (argc == 10) {
+    base_labels = label_sets::read(argv[8]);
+    query_label = query_labels(label_sets::read(argv[9]));
+    BL = &base_labels;
+    QL = &query_label;
+    std::cout << "Filtering by label" << std::endl;
+  }
   int k = std::atoi(argv[5]);
   int mips_choice = std::atoi(argv[6]);
   bool mips=false;
@@ -166,42 +284,32 @@ int main(int argc, char* argv[]) {
   if(ft == "vec"){
     if(tp == "float"){
       std::cout << "Detected float coordinates" << std::endl;
-      auto [md, B] = parse_fvecs(argv[1], NULL, maxDeg);
       auto [fd, Q] = parse_fvecs(argv[2], NULL, maxDeg);
-      std::cout << "Base file size " << B.size() << std::endl;
       std::cout << "Query file size " << Q.size() << std::endl;
-      answers = compute_groundtruth<float>(B, Q, k, mips);
+      answers = compute_groundtruth<float>(argv[1], true, Q, k, mips, BL, QL);
     }else if(tp == "uint8"){
       std::cout << "Detected uint8 coordinates" << std::endl;
-      auto [md, B] = parse_bvecs(argv[1], NULL, maxDeg);
       auto [fd, Q] = parse_bvecs(argv[2], NULL, maxDeg);
-      std::cout << "Base file size " << B.size() << std::endl;
       std::cout << "Query file size " << Q.size() << std::endl;
-      answers = compute_groundtruth<uint8_t>(B, Q, k, mips);
+      answers = compute_groundtruth<uint8_t>(argv[1], true, Q, k, mips, BL, QL);
     }
     write_ivecs(answers, std::string(argv[7]), k);
   } else if(ft == "bin"){
     if(tp == "float"){
       std::cout << "Detected float coordinates" << std::endl;
-      auto [md, B] = parse_fbin(argv[1], NULL, maxDeg);
       auto [fd, Q] = parse_fbin(argv[2], NULL, maxDeg);
-      std::cout << "Base file size " << B.size() << std::endl;
       std::cout << "Query file size " << Q.size() << std::endl;
-      answers = compute_groundtruth<float>(B, Q, k, mips);
+      answers = compute_groundtruth<float>(argv[1], false, Q, k, mips, BL, QL);
     }else if(tp == "uint8"){
       std::cout << "Detected uint8 coordinates" << std::endl;
-      auto [md, B] = parse_uint8bin(argv[1], NULL, maxDeg);
       auto [fd, Q] = parse_uint8bin(argv[2], NULL, maxDeg);
-      std::cout << "Base file size " << B.size() << std::endl;
       std::cout << "Query file size " << Q.size() << std::endl;
-      answers = compute_groundtruth<uint8_t>(B, Q, k, mips);
+      answers = compute_groundtruth<uint8_t>(argv[1], false, Q, k, mips, BL, QL);
     }else if(tp == "int8"){
       std::cout << "Detected int8 coordinates" << std::endl;
-      auto [md, B] = parse_int8bin(argv[1], NULL, maxDeg);
       auto [fd, Q] = parse_int8bin(argv[2], NULL, maxDeg);
-      std::cout << "Base file size " << B.size() << std::endl;
       std::cout << "Query file size " << Q.size() << std::endl;
-      answers = compute_groundtruth<int8_t>(B, Q, k, mips);
+      answers = compute_groundtruth<int8_t>(argv[1], false, Q, k, mips, BL, QL);
     }
     write_ibin(answers, std::string(argv[7]), k);
   }
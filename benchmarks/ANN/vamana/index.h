@@ -25,9 +25,15 @@
 #include "parlay/primitives.h"
 #include "parlay/random.h"
 #include "../utils/indexTools.h"
+#include "../utils/quantization.h"
+#include "../utils/searchContext.h"
+#include "../utils/tombstones.h"
+#include "../utils/inEdges.h"
+#include "../utils/labels.h"
 #include "common/geometry.h"
 #include <random>
 #include <set>
+#include <memory>
 #include <math.h>
 
 extern bool report_stats;
@@ -40,7 +46,9 @@ struct knn_index{
 	double r2_alpha; //alpha parameter for round 2 of robustPrune
 	unsigned d;
 	bool mips;
-	std::set<int> delete_set; 
+	tombstone_set tombstones; //points lazily deleted since the last consolidate_deletes
+	bool track_in_edges = false; //if set, in_edges is kept up to date for consolidate_deletes
+	in_edge_record in_edges;
 	using tvec_point = Tvec_point<T>;
 	using fvec_point = Tvec_point<float>;
 	tvec_point* medoid;
@@ -48,6 +56,9 @@ struct knn_index{
 	using slice_tvec = decltype(make_slice(parlay::sequence<tvec_point*>()));
 	using index_pair = std::pair<int, int>;
 	using slice_idx = decltype(make_slice(parlay::sequence<index_pair>()));
+	std::shared_ptr<quantized_points<T>> QP; //if set, used for all distances during build and search
+	std::shared_ptr<label_sets> labels; //if set, the graph is built for filtered search on them
+	parlay::sequence<int> label_start; //entry point of each label, -1 if no point carries it
 
 	knn_index(int md, int bs, double a, unsigned dim, bool m=false) : maxDeg(md), beamSize(bs), r2_alpha(a), d(dim), mips(m) {}
 
@@ -56,6 +67,12 @@ struct knn_index{
 		else return distance(p, q, d);
 	}
 
+	//distance between two points of v, on the quantized points if present
+	float PDistance(tvec_point* p, tvec_point* q){
+		if(QP != nullptr) return QP->distance(p->id, q->id);
+		return Distance(p->coordinates.begin(), q->coordinates.begin(), d);
+	}
+
 	float CDistance(float* p, T* q, unsigned d){
 		if(mips) return mips_distance(p, q, d);
 		else return distance(p, q, d);
@@ -131,7 +148,7 @@ struct knn_index{
     if(add){
     	for (size_t i=0; i<size_of(p->out_nbh); i++) {
 				candidates.push_back(std::make_pair(p->out_nbh[i],
-					Distance(v[p->out_nbh[i]]->coordinates.begin(), p->coordinates.begin(), d)));
+					PDistance(v[p->out_nbh[i]], p)));
 			}
     }
 		
@@ -157,9 +174,12 @@ struct knn_index{
       for (size_t i = candidate_idx; i < candidates.size(); i++) {
         int p_prime = candidates[i].first;
         if (p_prime != -1) {
-          float dist_starprime = Distance(v[p_star]->coordinates.begin(), v[p_prime]->coordinates.begin(), d);
+          float dist_starprime = PDistance(v[p_star], v[p_prime]);
           float dist_pprime = candidates[i].second;
-          if (alpha * dist_starprime <= dist_pprime) {
+          //with labels, p_star only stands in for p_prime if it carries
+          //every label that p and p_prime share
+          if (alpha * dist_starprime <= dist_pprime &&
+              (labels == nullptr || labels->covers(p->id, p_prime, p_star))) {
             candidates[i].first = -1;
           }
         }
@@ -175,15 +195,80 @@ struct knn_index{
     parlay::sequence<pid> cc;
     cc.reserve(candidates.size() + size_of(p->out_nbh));
     for (size_t i=0; i<candidates.size(); ++i) {
-      cc.push_back(std::make_pair(candidates[i], Distance(v[candidates[i]]->coordinates.begin(), p->coordinates.begin(), d)));
+      cc.push_back(std::make_pair(candidates[i], PDistance(v[candidates[i]], p)));
     }
     return robustPrune(p, std::move(cc), v, alpha, add);
 	}
 
+	//compresses the points, which are then used in place of the full
+	//precision coordinates to build and search the graph
+	void quantize(parlay::sequence<Tvec_point<T>*> &v, std::string method, unsigned subspaces=0){
+		QP = std::make_shared<quantized_points<T>>(v, quantized_points<T>::parse_method(method), subspaces, mips);
+		std::cout << "Quantization: " << method << ", bytes per point " << d*sizeof(T)
+			<< " -> " << QP->bytes_per_point() << std::endl;
+	}
+
+	//the graph is built, and searched, with filters on the labels L, as
+	//in Filtered-DiskANN: a point is inserted by a search from the entry
+	//points of its labels that only follows points sharing a label with
+	//it, and pruning keeps an edge for each label shared with a neighbor
+	void set_labels(std::shared_ptr<label_sets> L, parlay::sequence<Tvec_point<T>*> &v){
+		if(L->size() != v.size()){
+			std::cout << "Error: labels for " << L->size() << " points, but there are "
+				<< v.size() << " points" << std::endl;
+			abort();
+		}
+		labels = L;
+		std::cout << "Labels: " << labels->num_labels << ", average per point "
+			<< labels->labels.size()/((double) labels->size()) << std::endl;
+	}
+
+	//the entry point of each label is, among the inserted points carrying
+	//it, the one closest to their centroid
+	void find_label_starts(parlay::sequence<Tvec_point<T>*> &v, parlay::sequence<int> &inserts){
+		parlay::sequence<bool> inserted(v.size(), false);
+		parlay::parallel_for(0, inserts.size(), [&] (size_t i) {inserted[inserts[i]] = true;});
+		auto per_label = labels->points_per_label();
+		label_start = parlay::tabulate(per_label.size(), [&] (size_t l) {
+			auto pts = parlay::map(parlay::filter(per_label[l], [&] (int i) {return inserted[i];}),
+				[&] (int i) {return v[i];});
+			if(pts.size() == 0) return -1;
+			parlay::sequence<float> centroid = centroid_helper(parlay::make_slice(pts));
+			fvec_point centroidp = Tvec_point<float>();
+			centroidp.coordinates = parlay::make_slice(centroid);
+			return medoid_helper(&centroidp, parlay::make_slice(pts))->id;
+		}, 1);
+	}
+
+	//the points visited by the search that inserts p, sorted by distance
+	parlay::sequence<pid> insert_search(tvec_point* p, parlay::sequence<Tvec_point<T>*> &v){
+		if(labels == nullptr || labels->of(p->id).size() == 0)
+			return (beam_search(p, v, medoid, beamSize, d, mips, 0, 1.14, -1, QP.get())).first.second;
+		auto starts = parlay::map(labels->of(p->id), [&] (int l) {return v[label_start[l]];});
+		search_context& ctx = beam_search_local(p, v, starts.begin(), starts.size(), beamSize, d, mips,
+			0, 1.14, -1, QP.get(), [&] (int j) {return labels->intersects(p->id, j);});
+		return ctx.sorted_visited();
+	}
+
+	//sets the entry points of a graph that was built beforehand
+	void use_built_graph(parlay::sequence<Tvec_point<T>*> &v){
+		find_approx_medoid(v);
+		if(labels != nullptr){
+			auto all = parlay::tabulate(v.size(), [&] (size_t i) {return static_cast<int>(i);});
+			find_label_starts(v, all);
+		}
+	}
+
 	void build_index(parlay::sequence<Tvec_point<T>*> &v, parlay::sequence<int> inserts, bool two_pass=false){
 		std::cout << "Mips: " << mips << std::endl;
 		clear(v);
-		find_approx_medoid(v);
+		if(track_in_edges){
+			in_edges.resize(v.size());
+			in_edges.clear();
+		}
+		auto inserted = parlay::tabulate(inserts.size(), [&] (size_t i) {return v[inserts[i]];});
+		find_approx_medoid(inserted);
+		if(labels != nullptr) find_label_starts(v, inserts);
 		if(two_pass){
 		  std::cout << "Starting first pass" << std::endl; 
 		  batch_insert(inserts, v, true, 1.0, 2, .02, two_pass);
@@ -192,19 +277,44 @@ struct knn_index{
 		batch_insert(inserts, v, true, r2_alpha, 2, .02,  two_pass);
 	}
 
+	bool points_to(int u, int p, parlay::sequence<Tvec_point<T>*> &v){
+		for(int j=0; j<size_of(v[u]->out_nbh); j++)
+			if(v[u]->out_nbh[j] == p) return true;
+		return false;
+	}
+
+	//records the edges written by a batch of inserts, once they are all in
+	//place; grouped_by is the batch's new edges grouped by their target
+	template<typename Batch, typename Grouped>
+	void record_batch_edges(Batch const &batch, Grouped &grouped_by,
+		parlay::sequence<Tvec_point<T>*> &v){
+		in_edges.resize(v.size());
+		auto has_edge = [&] (int u, int p) {return points_to(u, p, v);};
+		parlay::parallel_for(0, grouped_by.size(), [&] (size_t j){
+			in_edges.add(grouped_by[j].first, grouped_by[j].second, maxDeg, has_edge);
+		});
+		//and each target was given an edge back, unless it pruned it away
+		parlay::parallel_for(0, batch.size(), [&] (size_t i){
+			tvec_point* p = v[batch[i]];
+			in_edges.add(p->id, p->out_nbh.cut(0, size_of(p->out_nbh)), maxDeg, has_edge);
+		});
+	}
+
 	void lazy_delete(parlay::sequence<int> deletes, parlay::sequence<Tvec_point<T>*> &v){
-		for(int p : deletes){
-			if(p < 0 || p > (int) v.size() ){
+		tombstones.resize(v.size());
+		parlay::parallel_for(0, deletes.size(), [&] (size_t i){
+			int p = deletes[i];
+			if(p < 0 || p >= (int) v.size() ){
 				std::cout << "ERROR: invalid point " << p << " given to lazy_delete" << std::endl; 
 				abort();
 			}
-			if(p != medoid->id) delete_set.insert(p);
+			if(p != medoid->id) tombstones.insert(p);
 			else std::cout << "Deleting medoid not permitted; continuing" << std::endl; 
-		} 
+		});
 	}
 
 	void lazy_delete(int p, parlay::sequence<Tvec_point<T>*> &v){
-		if(p < 0 || p > (int) v.size()){
+		if(p < 0 || p >= (int) v.size()){
 			std::cout << "ERROR: invalid point " << p << " given to lazy_delete" << std::endl; 
 			abort();
 		}
@@ -212,56 +322,83 @@ struct knn_index{
 			std::cout << "Deleting medoid not permitted; continuing" << std::endl; 
 			return;
 		} 
-		delete_set.insert(p);
+		tombstones.resize(v.size());
+		tombstones.insert(p);
 	}
 
+	//removes the lazily deleted points from the graph; only the points
+	//with a deleted out-neighbor are rewritten, replacing each deleted
+	//neighbor by its own live out-neighbors and pruning if that overflows
+	//the degree bound.  With track_in_edges those points are found from
+	//the in-neighbors of the deleted points, otherwise by a scan of every
+	//out-list
 	void consolidate_deletes(parlay::sequence<Tvec_point<T>*> &v){
-		//clear deleted neighbors out of delete set for preprocessing
+		if(tombstones.size() == 0) return;
+		auto deleted = tombstones.members();
+		auto live = [&] (int j) {return !tombstones.contains(j);};
+
+		//clear deleted neighbors out of the deleted points, which are spliced in below
+		parlay::parallel_for(0, deleted.size(), [&] (size_t i){
+			tvec_point* p = v[deleted[i]];
+			auto nbh = p->out_nbh.cut(0, size_of(p->out_nbh));
+			parlay::sequence<int> new_edges = parlay::filter(nbh, live);
+			if(new_edges.size() < nbh.size()) add_out_nbh(new_edges, p);
+		});
 
-		parlay::parallel_for(0, v.size(), [&] (size_t i){
-			if(delete_set.find(i) != delete_set.end()){
-				parlay::sequence<int> new_edges; 
-				for(int j=0; j<size_of(v[i]->out_nbh); j++){
-					if(delete_set.find(v[i]->out_nbh[j]) == delete_set.end()) new_edges.push_back(v[i]->out_nbh[j]);
-				}
-				if(new_edges.size() < size_of(v[i]->out_nbh)) add_out_nbh(new_edges, v[i]); 
-			}
+		parlay::sequence<int> affected;
+		if(track_in_edges){
+			tombstone_set seen;
+			seen.resize(v.size());
+			parlay::parallel_for(0, deleted.size(), [&] (size_t i){
+				for(int u : in_edges.sources(deleted[i]))
+					if(live(u) && points_to(u, deleted[i], v)) seen.insert(u);
+			});
+			affected = seen.members();
+		} else affected = parlay::filter(parlay::iota<int>(v.size()), [&] (int i){
+			if(!live(i)) return false;
+			for(int j=0; j<size_of(v[i]->out_nbh); j++)
+				if(!live(v[i]->out_nbh[j])) return true;
+			return false;
 		});
 
-		parlay::parallel_for(0, v.size(), [&] (size_t i){
-			if(delete_set.find(i) == delete_set.end() && size_of(v[i]->out_nbh) != 0){
-				std::set<int> new_edges;
-				bool modify = false;
-				for(int j=0; j<size_of(v[i]->out_nbh); j++){
-					if(delete_set.find(v[i]->out_nbh[j]) == delete_set.end()){
-						new_edges.insert(v[i]->out_nbh[j]);
-					} else{
-						modify = true;
-						int index = v[i]->out_nbh[j];
-						for(int k=0; k<size_of(v[index]->out_nbh); k++) new_edges.insert(v[index]->out_nbh[k]);
-					}
-				}
-				//TODO only prune if overflow happens
-				//TODO modify in separate step with new memory initialized in one block
-				if(modify){ 
-					parlay::sequence<int> candidates;
-					for(int j : new_edges) candidates.push_back(j);
-					parlay::sequence<int> new_neighbors(maxDeg, -1);
-					v[i]->new_nbh = parlay::make_slice(new_neighbors.begin(), new_neighbors.end());
-					robustPrune(v[i], candidates, v, r2_alpha, false);
-					synchronize(v[i]);
+		parlay::sequence<int> new_out(maxDeg*affected.size(), -1);
+		parlay::parallel_for(0, affected.size(), [&] (size_t i){
+			tvec_point* p = v[affected[i]];
+			parlay::sequence<int> candidates;
+			for(int j=0; j<size_of(p->out_nbh); j++){
+				int u = p->out_nbh[j];
+				if(live(u)) candidates.push_back(u);
+				else for(int k=0; k<size_of(v[u]->out_nbh); k++){
+					int w = v[u]->out_nbh[k];
+					if(w != p->id) candidates.push_back(w);
 				}
-				
-			} 
-		});
-		parlay::parallel_for(0, v.size(), [&] (size_t i){
-			if(delete_set.find(i) != delete_set.end()){
-				clear(v[i]);
-			} 
+			}
+			std::sort(candidates.begin(), candidates.end());
+			candidates.resize(std::unique(candidates.begin(), candidates.end()) - candidates.begin());
+			p->new_nbh = parlay::make_slice(new_out.begin()+maxDeg*i, new_out.begin()+maxDeg*(i+1));
+			if(candidates.size() <= (size_t) maxDeg) add_new_nbh(candidates, p);
+			else robustPrune(p, candidates, v, r2_alpha, false);
 		});
- 
-		delete_set.clear();
-
+		parlay::parallel_for(0, affected.size(), [&] (size_t i) {synchronize(v[affected[i]]);});
+		parlay::parallel_for(0, deleted.size(), [&] (size_t i) {clear(v[deleted[i]]);});
+		if(track_in_edges){
+			//the rewritten points may have new out-neighbors from the
+			//deleted points' lists
+			auto edges = parlay::flatten(parlay::tabulate(affected.size(), [&] (size_t i){
+				tvec_point* p = v[affected[i]];
+				return parlay::tabulate(size_of(p->out_nbh), [&] (size_t j){
+					return std::make_pair(p->out_nbh[j], p->id);});
+			}));
+			auto grouped_by = parlay::group_by_key(edges);
+			auto has_edge = [&] (int u, int p) {return points_to(u, p, v);};
+			parlay::parallel_for(0, grouped_by.size(), [&] (size_t j){
+				in_edges.add(grouped_by[j].first, grouped_by[j].second, maxDeg, has_edge);
+			});
+			parlay::parallel_for(0, deleted.size(), [&] (size_t i) {in_edges.clear(deleted[i]);});
+		}
+		std::cout << "Consolidated " << deleted.size() << " deletes, rewrote " << affected.size()
+			<< " points" << std::endl;
+		tombstones.clear();
 	}
 
 	void insert_and_count(parlay::sequence<int> &inserts, parlay::sequence<Tvec_point<T>*> &v, 
@@ -280,7 +417,7 @@ struct knn_index{
 		parlay::parallel_for(floor, ceiling, [&] (size_t i){
 			size_t index = shuffled_inserts[i];
 			v[index]->new_nbh = parlay::make_slice(new_out.begin()+maxDeg*(i-floor), new_out.begin()+maxDeg*(i+1-floor));
-			parlay::sequence<pid> visited = (beam_search(v[index], v, medoid, beamSize, d, mips)).first.second;
+			parlay::sequence<pid> visited = insert_search(v[index], v);
 			if(report_stats) v[index]->visited = visited.size();
 			robustPrune(v[index], visited, v, alpha);
 		});
@@ -319,6 +456,7 @@ struct knn_index{
 				synchronize(v[index]);
 			}
 		});	
+		if(track_in_edges) record_batch_edges(shuffled_inserts.cut(floor, ceiling), grouped_by, v);
 	}
 
 	void batch_insert(parlay::sequence<int> &inserts, parlay::sequence<Tvec_point<T>*> &v, bool random_order = false, double alpha = 1.2, double base = 2,
@@ -336,8 +474,7 @@ struct knn_index{
 		size_t m = inserts.size();
 		size_t inc = 0;
 		size_t count = 0;
-		size_t max_batch_size=1;  
-		// size_t max_batch_size = std::min(static_cast<size_t>(max_fraction*static_cast<float>(n)), 1000000ul);
+		size_t max_batch_size = std::max<size_t>(1, std::min(static_cast<size_t>(max_fraction*static_cast<float>(n)), 1000000ul));
 		parlay::sequence<int> rperm;
 		if(random_order) rperm = parlay::random_permutation<int>(static_cast<int>(m));
 		else rperm = parlay::tabulate(m, [&] (int i) {return i;});
@@ -346,12 +483,12 @@ struct knn_index{
 			size_t floor;
 			size_t ceiling;
 			if(pow(base,inc) <= max_batch_size){
-				floor = static_cast<size_t>(pow(base, inc))-1;
-				ceiling = std::min(static_cast<size_t>(pow(base, inc+1)), m)-1;
-				count = std::min(static_cast<size_t>(pow(base, inc+1)), m)-1;
+				floor = std::min(static_cast<size_t>(pow(base, inc))-1, m);
+				ceiling = std::min(static_cast<size_t>(pow(base, inc+1))-1, m);
+				count = ceiling;
 			} else{
 				floor = count;
-				ceiling = std::min(count + static_cast<size_t>(max_batch_size), m)-1;
+				ceiling = std::min(count + static_cast<size_t>(max_batch_size), m);
 				count += static_cast<size_t>(max_batch_size);
 			}
 			parlay::sequence<int> new_out = parlay::sequence<int>(maxDeg*(ceiling-floor), -1);
@@ -360,7 +497,7 @@ struct knn_index{
 			parlay::parallel_for(floor, ceiling, [&] (size_t i){
 				size_t index = shuffled_inserts[i];
 				v[index]->new_nbh = parlay::make_slice(new_out.begin()+maxDeg*(i-floor), new_out.begin()+maxDeg*(i+1-floor));
-				parlay::sequence<pid> visited = (beam_search(v[index], v, medoid, beamSize, d, mips)).first.second;
+				parlay::sequence<pid> visited = insert_search(v[index], v);
 				if(report_stats) v[index]->visited = visited.size();
 				robustPrune(v[index], visited, v, alpha);
 			});
@@ -390,6 +527,7 @@ struct knn_index{
 					synchronize(v[index]);
 				}
 			});
+			if(track_in_edges) record_batch_edges(shuffled_inserts.cut(floor, ceiling), grouped_by, v);
 			inc += 1;
 		}
 	}
@@ -421,9 +559,41 @@ struct knn_index{
 
 
   void searchNeighbors(parlay::sequence<Tvec_point<T>*> &q, parlay::sequence<Tvec_point<T>*> &v, int beamSizeQ, int k, float cut){
-    searchAll(q, v, beamSizeQ, k, d, medoid, mips, cut);
+    searchAll(q, v, beamSizeQ, k, d, medoid, mips, cut, -1, QP.get());
   }
 
+	//searches for p from the medoid, leaving out points that are deleted
+	//but not yet consolidated, and returns its k nearest live points
+	parlay::sequence<int> search_live(tvec_point* p, parlay::sequence<Tvec_point<T>*> &v, int beamSizeQ, int k, float cut=1.14){
+		//the beam is not cut to k while deleted points may be among the closest
+		bool cut_beam = (tombstones.size() == 0);
+		search_context& ctx = beam_search_local(p, v, &medoid, 1, beamSizeQ, d, mips,
+			cut_beam ? k : 0, cut, -1, QP.get());
+		if(QP != nullptr) rerank(p, v, ctx, d, mips);
+		parlay::sequence<int> ngh(k, -1);
+		int found = 0;
+		for(size_t j=0; j<ctx.beam_size && found<k; j++)
+			if(!tombstones.contains(ctx.beam[j].id)) ngh[found++] = ctx.beam[j].id;
+		return ngh;
+	}
+
+	//searches for each q[i] among the points carrying the label
+	//query_label[i], from the entry point of that label
+	void filteredSearch(parlay::sequence<Tvec_point<T>*> &q, parlay::sequence<Tvec_point<T>*> &v, int beamSizeQ, int k,
+		parlay::sequence<int> &query_label, float cut=1.14){
+		parlay::parallel_for(0, q.size(), [&] (size_t i){
+			int f = query_label[i];
+			if(f < 0 || f >= (int) label_start.size() || label_start[f] == -1){
+				q[i]->ngh = parlay::sequence<int>(k, -1);
+				q[i]->visited = 0;
+				q[i]->dist_calls = 0;
+				return;
+			}
+			search_one(q[i], v, beamSizeQ, k, d, &v[label_start[f]], 1, mips, cut, -1, QP.get(),
+				[&] (int j) {return labels->has(j, f);});
+		}, 1);
+	}
+
   void rangeSearch(parlay::sequence<Tvec_point<T>*> &q, parlay::sequence<Tvec_point<T>*> &v, 
   	int beamSizeQ, double r, int k, float cut=1.14, double slack = 3.0){
 		rangeSearchAll(q, v, beamSizeQ, d, medoid, r, k, cut, slack);
@@ -0,0 +1,66 @@
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include "parlay/parallel.h"
+#include "parlay/primitives.h"
+#include "parlay/utilities.h"
+#include "../utils/labels.h"
+
+// Generates labels for a filtered search benchmark.  Point i carries
+// label l with probability selectivity/(l+1)^zipf, independently of its
+// other labels, so zipf = 0 gives labels of equal selectivity and larger
+// values a few common labels and many rare ones.  Each query gets one
+// label, uniformly among those carried by at least min_matches points.
+// The ground truth for the labelled queries is then computed by
+// compute_groundtruth with the two label files.
+
+// uniform in [0, 1), a function of (i, l) only
+double coin(size_t i, size_t l){
+  return (parlay::hash64(i * 1000003 + l) >> 11) * (1.0 / (1ull << 53));
+}
+
+int main(int argc, char* argv[]) {
+  if (argc != 9) {
+    std::cout << "usage: make_labels <num points> <num queries> <num labels> <selectivity> <zipf> "
+              << "<min matches> <base labels oFile> <query labels oFile>" << std::endl;
+    return 1;
+  }
+  size_t n = std::atol(argv[1]);
+  size_t nq = std::atol(argv[2]);
+  int L = std::atoi(argv[3]);
+  double selectivity = std::atof(argv[4]);
+  double zipf = std::atof(argv[5]);
+  size_t min_matches = std::atol(argv[6]);
+  if (L < 1 || selectivity <= 0 || selectivity > 1 || zipf < 0) {
+    std::cout << "Error: need at least one label, a selectivity in (0, 1] and a nonnegative zipf exponent" << std::endl;
+    abort();
+  }
+
+  auto p = parlay::tabulate(L, [&] (size_t l) {return std::min(1.0, selectivity / std::pow(l+1, zipf));});
+  auto sets = parlay::tabulate(n, [&] (size_t i) {
+    parlay::sequence<int> s;
+    for (int l=0; l<L; l++) if (coin(i, l) < p[l]) s.push_back(l);
+    return s;
+  });
+  label_sets B(sets, L);
+
+  auto counts = parlay::map(B.points_per_label(), [] (auto &s) {return s.size();});
+  auto eligible = parlay::filter(parlay::iota<int>(L), [&] (int l) {return counts[l] >= min_matches;});
+  if (eligible.size() == 0) {
+    std::cout << "Error: no label is carried by " << min_matches << " points" << std::endl;
+    abort();
+  }
+  auto qsets = parlay::tabulate(nq, [&] (size_t i) {
+    return parlay::sequence<int>(1, eligible[parlay::hash64(i) % eligible.size()]);});
+  label_sets Q(qsets, L);
+
+  auto qsel = parlay::delayed_seq<double>(nq, [&] (size_t i) {return counts[Q.of(i)[0]] / (double) n;});
+  std::cout << "Labels per point: " << B.labels.size() / (double) n << std::endl;
+  std::cout << "Label selectivity: min " << *std::min_element(counts.begin(), counts.end()) / (double) n
+            << ", max " << *std::max_element(counts.begin(), counts.end()) / (double) n << std::endl;
+  std::cout << eligible.size() << " labels used by queries, average query selectivity "
+            << parlay::reduce(qsel) / nq << std::endl;
+  B.write(argv[7]);
+  Q.write(argv[8]);
+  return 0;
+}
@@ -21,6 +21,7 @@
 // WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #include <algorithm>
+#include <chrono>
 #include "parlay/parallel.h"
 #include "parlay/primitives.h"
 #include "parlay/random.h"
@@ -33,8 +34,36 @@
 #include "../utils/stats.h"
 #include "../utils/parse_results.h"
 #include "../utils/check_nn_recall.h"
+#include "../utils/indexFile.h"
 
 extern bool report_stats;
+extern std::string quant_method;
+extern int quant_subspaces;
+extern std::string base_label_file;
+extern std::string query_label_file;
+
+//as search_and_parse, for filtered queries: sweeps the beam width and cut
+//of filteredSearch and reports the fastest setting per recall bucket
+template<typename T>
+void filtered_search_and_parse(Graph G, knn_index<T> &I, parlay::sequence<Tvec_point<T>*> &v,
+    parlay::sequence<Tvec_point<T>*> &q, parlay::sequence<int> &query_label,
+    parlay::sequence<ivec_point> &groundTruth, char* res_file){
+  parlay::sequence<nn_result> results;
+  std::vector<int> beams = {15, 20, 30, 50, 75, 100, 125, 250, 500};
+  std::vector<float> cuts = {1.1, 1.125, 1.15, 1.175, 1.2, 1.25};
+  for(float cut : cuts)
+    for(int Q : beams){
+      parlay::internal::timer t;
+      I.filteredSearch(q, v, Q, 10, query_label, cut);
+      t.next_time();
+      I.filteredSearch(q, v, Q, 10, query_label, cut);
+      float QPS = q.size()/t.next_time();
+      results.push_back(nn_result(nn_recall(q, groundTruth), query_stats(q), QPS, 10, Q, cut, q.size()));
+    }
+  parlay::sequence<float> buckets = {.1, .15, .2, .25, .3, .35, .4, .45, .5, .55, .6, .65, .7, .73, .75, .77, .8, .83, .85, .87, .9, .93, .95, .97, .99, .995, .999};
+  auto [res, ret_buckets] = parse_result(results, buckets);
+  if(res_file != NULL) write_to_csv(std::string(res_file), ret_buckets, res, G);
+}
 
 template<typename T>
 void ANN(parlay::sequence<Tvec_point<T>*> &v, int k, int maxDeg,
@@ -45,9 +74,11 @@ void ANN(parlay::sequence<Tvec_point<T>*> &v, int k, int maxDeg,
   unsigned d = (v[0]->coordinates).size();
   using findex = knn_index<T>;
   findex I(maxDeg, beamSize, alpha, d, mips);
+  if(quant_method != "none") I.quantize(v, quant_method, quant_subspaces);
+  if(base_label_file != "") I.set_labels(std::make_shared<label_sets>(label_sets::read(base_label_file.c_str())), v);
   double idx_time;
   if(graph_built){
-    I.find_approx_medoid(v);
+    I.use_built_graph(v);
     idx_time = 0;
   } else{
     parlay::sequence<int> inserts = parlay::tabulate(v.size(), [&] (size_t i){
@@ -64,7 +95,19 @@ void ANN(parlay::sequence<Tvec_point<T>*> &v, int k, int maxDeg,
   std::cout << "Average visited: " << vv[0] << ", Tail visited: " << vv[1] << std::endl;
   Graph G(name, params, v.size(), avg_deg, max_deg, idx_time);
   G.print();
-  search_and_parse(G, v, q, groundTruth, res_file, mips, false, medoid);
+  set_index_info(name, params, {medoid}, idx_time, mips, I.QP);
+  if(query_label_file != ""){
+    if(I.labels == nullptr){
+      std::cout << "Error: filtered queries need labels for the points (-lb)" << std::endl;
+      abort();
+    }
+    auto query_label = query_labels(label_sets::read(query_label_file.c_str()));
+    if(query_label.size() != q.size()){
+      std::cout << "Error: " << query_label.size() << " query labels for " << q.size() << " queries" << std::endl;
+      abort();
+    }
+    filtered_search_and_parse(G, I, v, q, query_label, groundTruth, res_file);
+  } else search_and_parse(G, v, q, groundTruth, res_file, mips, false, medoid, I.QP.get());
   
 }
 
@@ -76,13 +119,17 @@ void ANN(parlay::sequence<Tvec_point<T>*> v, int maxDeg, int beamSize, double al
     unsigned d = (v[0]->coordinates).size();
     using findex = knn_index<T>;
     findex I(maxDeg, beamSize, alpha, d, mips);
-    if(graph_built) I.find_approx_medoid(v);
+    if(quant_method != "none") I.quantize(v, quant_method, quant_subspaces);
+    if(base_label_file != "") I.set_labels(std::make_shared<label_sets>(label_sets::read(base_label_file.c_str())), v);
+    if(graph_built) I.use_built_graph(v);
     else{
       parlay::sequence<int> inserts = parlay::tabulate(v.size(), [&] (size_t i){
 					    return static_cast<int>(i);});
       I.build_index(v, inserts);
-      t.next("Built index");
     }
+    set_index_info("Vamana", "R = " + std::to_string(maxDeg) + ", L = " + std::to_string(beamSize),
+		   {I.get_medoid()}, t.total_time(), mips, I.QP);
+    if(!graph_built) t.next("Built index");
     if(report_stats){
       graph_stats(v);
       t.next("stats");
@@ -90,3 +137,102 @@ void ANN(parlay::sequence<Tvec_point<T>*> v, int maxDeg, int beamSize, double al
   };
 }
 
+//exact k nearest neighbors of each point of q among the points ids of v
+template<typename T>
+parlay::sequence<parlay::sequence<int>> exact_knn(parlay::sequence<Tvec_point<T>*> &q,
+	parlay::sequence<Tvec_point<T>*> &v, parlay::sequence<int> &ids, int k, unsigned d, bool mips){
+  return parlay::tabulate(q.size(), [&] (size_t i) {
+    parlay::sequence<std::pair<float, int>> dists(ids.size());
+    for(size_t j=0; j<ids.size(); j++){
+      T* c = v[ids[j]]->coordinates.begin();
+      float dist = mips ? mips_distance(q[i]->coordinates.begin(), c, d) : distance(q[i]->coordinates.begin(), c, d);
+      dists[j] = std::make_pair(dist, ids[j]);
+    }
+    size_t m = std::min<size_t>(k, ids.size());
+    std::partial_sort(dists.begin(), dists.begin()+m, dists.end());
+    return parlay::tabulate(m, [&] (size_t j) {return dists[j].second;});
+  }, 1);
+}
+
+//Replays a sliding window over the points of v in file order: the
+//index is built on the first window points, then each step inserts the
+//next step points, lazily deletes the oldest step points, consolidates
+//the deletes once they exceed consolidate times the window, and answers
+//the queries in q on the live points.  Reports for each step the update
+//throughput, the query latencies and the recall against the exact
+//neighbors among the live points, so that drift in recall over the
+//stream shows up.
+template<typename T>
+void ANN_stream(parlay::sequence<Tvec_point<T>*> &v, int k, int maxDeg, int beamSize, int beamSizeQ,
+	double alpha, parlay::sequence<Tvec_point<T>*> &q, size_t window, size_t step,
+	double consolidate, bool mips) {
+  parlay::internal::timer t("ANN",report_stats);
+  size_t n = v.size();
+  if(window >= n || step == 0){
+    std::cout << "Error: stream window " << window << " and step " << step
+	      << " do not fit " << n << " points" << std::endl;
+    abort();
+  }
+  unsigned d = (v[0]->coordinates).size();
+  knn_index<T> I(maxDeg, beamSize, alpha, d, mips);
+  if(quant_method != "none") I.quantize(v, quant_method, quant_subspaces);
+  I.track_in_edges = true;
+  I.build_index(v, parlay::tabulate(window, [&] (size_t i) {return static_cast<int>(i);}));
+  std::cout << "Built on the first " << window << " points in " << t.next_time() << std::endl;
+  int medoid = I.get_medoid();
+
+  size_t begin = 0, end = window;
+  size_t updates = 0;
+  double update_time = 0;
+  parlay::sequence<double> recalls;
+  while(end < n){
+    size_t m = std::min(step, n - end);
+    auto inserts = parlay::tabulate(m, [&] (size_t i) {return static_cast<int>(end+i);});
+    auto deletes = parlay::tabulate(m, [&] (size_t i) {return static_cast<int>(begin+i);});
+    t.next_time();
+    I.batch_insert(inserts, v, true, alpha);
+    double insert_time = t.next_time();
+    I.lazy_delete(deletes, v);
+    double delete_time = t.next_time();
+    double consolidate_time = 0;
+    if(I.tombstones.size() > consolidate*window){
+      I.consolidate_deletes(v);
+      consolidate_time = t.next_time();
+    }
+    begin += m; end += m;
+    double step_time = insert_time + delete_time + consolidate_time;
+    updates += 2*m;
+    update_time += step_time;
+
+    //the medoid is never deleted, so it stays live after leaving the window
+    auto live = parlay::filter(parlay::iota<int>(end), [&] (int i) {
+	return static_cast<size_t>(i) >= begin || i == medoid;});
+    auto gt = exact_knn(q, v, live, k, d, mips);
+    parlay::sequence<double> latency(q.size());
+    parlay::sequence<parlay::sequence<int>> results(q.size());
+    t.next_time();
+    parlay::parallel_for(0, q.size(), [&] (size_t i) {
+      auto start = std::chrono::steady_clock::now();
+      results[i] = I.search_live(q[i], v, beamSizeQ, k);
+      latency[i] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }, 1);
+    double query_time = t.next_time();
+    auto hits = parlay::tabulate(q.size(), [&] (size_t i) {
+      size_t h = 0;
+      for(int r : results[i]) h += (r != -1 && std::find(gt[i].begin(), gt[i].end(), r) != gt[i].end());
+      return h;});
+    double recall = parlay::reduce(hits) / static_cast<double>(q.size()*k);
+    recalls.push_back(recall);
+    auto lat = latency_stats(latency);
+    std::cout << "Step " << recalls.size() << ": window [" << begin << ", " << end << "), "
+	      << "updates " << 2*m/step_time << "/second";
+    if(consolidate_time > 0) std::cout << " (consolidated in " << consolidate_time << ")";
+    std::cout << ", queries " << q.size()/query_time << "/second, latency avg "
+	      << lat[0]*1e6 << " p50 " << lat[1]*1e6 << " p99 " << lat[2]*1e6 << " us"
+	      << ", recall " << recall << std::endl;
+  }
+  std::cout << "Stream of " << recalls.size() << " steps: " << updates/update_time
+	    << " updates/second, recall first " << recalls[0] << ", min "
+	    << *std::min_element(recalls.begin(), recalls.end()) << ", last "
+	    << recalls[recalls.size()-1] << std::endl;
+}
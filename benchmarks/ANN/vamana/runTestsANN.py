@@ -2,6 +2,9 @@ import subprocess
 import sys
 import random
 import os
+import socket
+import time
+from runTests import recordResult, gitRevision, numThreads, median
 
 def addLineToFile(oFile, line):
     with open("oFile", "a+") as file_object:
@@ -51,7 +54,8 @@ def runSingle(runProgram, options, ifile, procs, oFile) :
   except (ValueError,IndexError):
     raise NameError(comString+"\n"+out)
 
-def runTest(runProgram, checkProgram, dataDir, test, rounds, procs, noOutput, oFile) :
+def runTest(runProgram, checkProgram, dataDir, test, rounds, procs, noOutput, oFile,
+            jsonFile=None, csvFile=None) :
     random.seed()
     outFile="/tmp/ofile%d_%d" %(random.randint(0, 1000000), random.randint(0, 1000000)) 
     [weight, gFileName, qFileName, iFileName, runOptions, checkOptions] = test
@@ -73,11 +77,30 @@ def runTest(runProgram, checkProgram, dataDir, test, rounds, procs, noOutput, oF
     if len(dataDir)>0:
       out = shellGetOutput("cd " + dataDir + "; make " + shortiFileName)
     longiFileName = " ".join(dataDir + "/" + name for name in iFileName)
+    baseOptions = runOptions
     runOptions = runOptions + " -q " + longqFileName
     runOptions = runOptions + " -r " + repr(rounds)
     if (noOutput == 0) :
       runOptions = runOptions + " -o " + outFile
     times = runSingle(runProgram, runOptions, longgFileName, procs, oFile)
+    # the same record as common/runTests.py, with the checker's recall
+    # report in place of a pass/fail outcome
+    record = {"benchmark" : os.path.basename(os.getcwd()),
+              "program" : runProgram,
+              "input" : shortgFileName,
+              "queries" : shortqFileName,
+              "options" : baseOptions,
+              "threads" : numThreads(procs),
+              "numa" : "none",
+              "rounds" : rounds,
+              "times" : times,
+              "min" : min(times),
+              "median" : median(times),
+              "mean" : sum(times)/len(times),
+              "check" : "skipped" if noOutput else "reported",
+              "revision" : gitRevision(),
+              "host" : socket.gethostname(),
+              "date" : time.strftime("%Y-%m-%d %H:%M:%S")}
     if (noOutput == 0) :
       checkString = ("./" + checkProgram + " " + checkOptions + " "
                      + longiFileName + " " + outFile)
@@ -86,6 +109,7 @@ def runTest(runProgram, checkProgram, dataDir, test, rounds, procs, noOutput, oF
       for line in nonCommentLines:
         print(line)
         addLineToFile(oFile, line)
+      record["checkOutput"] = nonCommentLines
       os.remove(outFile)
     ptimes = str([stripFloat(time)
                   for time in times])[1:-1]
@@ -95,6 +119,7 @@ def runTest(runProgram, checkProgram, dataDir, test, rounds, procs, noOutput, oF
     outStr = repr(weight) + outputStr + " : " + ptimes
     print(outStr)
     addLineToFile(oFile, outStr)
+    recordResult(record, jsonFile, csvFile)
     return [weight,times]
     
 def averageTime(times) :
@@ -102,12 +127,12 @@ def averageTime(times) :
     
 
 def timeAll(name, runProgram, checkProgram, dataDir, tests, rounds, procs, noOutput,
-            problem, oFile) :
+            problem, oFile, jsonFile=None, csvFile=None) :
   totalTime = 0
   totalWeight = 0
   try:
     results = [runTest(runProgram, checkProgram, dataDir, test, rounds, procs,
-                       noOutput, oFile)
+                       noOutput, oFile, jsonFile, csvFile)
                for test in tests]
     totalTimeMean = 0
     totalTimeMin = 0
@@ -122,7 +147,7 @@ def timeAll(name, runProgram, checkProgram, dataDir, tests, rounds, procs, noOut
       times = sorted(times)
       totalTimeMean = totalTimeMean + weight*sum(times)/l
       totalTimeMin = totalTimeMin + weight*times[0]
-      totalTimeMedian = totalTimeMedian + weight*times[(l-1)/2]
+      totalTimeMedian = totalTimeMedian + weight*times[(l-1)//2]
       totalWeight = totalWeight + weight
       j += 1
     print(name + " : " + repr(procs) +" : " +
@@ -157,10 +182,13 @@ def getArgs() :
   noOutput = getOption("-x")
   processors = int(getArg("-p", 0))
   rounds = int(getArg("-r", 1))
-  return (noOutput, rounds, processors)
+  jsonFile = getArg("-json", None)
+  csvFile = getArg("-csv", None)
+  return (noOutput, rounds, processors, jsonFile, csvFile)
 
 def timeAllArgs(runProgram, problem, checkProgram, dataDir, tests, oFile) :
-    (noOutput, rounds, procs) = getArgs()
+    (noOutput, rounds, procs, jsonFile, csvFile) = getArgs()
     name = os.path.basename(os.getcwd())
-    timeAll(name, runProgram, checkProgram, dataDir, tests, rounds, procs, noOutput, problem, oFile)
+    timeAll(name, runProgram, checkProgram, dataDir, tests, rounds, procs, noOutput, problem, oFile,
+            jsonFile, csvFile)
 
@@ -0,0 +1,164 @@
+// This code is part of the Problem Based Benchmark Suite (PBBS)
+// Copyright (c) 2010 Guy Blelloch and the PBBS team
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights (to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+#include "parlay/parallel.h"
+#include "parlay/primitives.h"
+#include "parlay/sequence.h"
+
+// **************************************************************
+// A sort for strings that looks at their characters rather than
+// comparing them, for the string inputs of sortTime -s (the comparison
+// sort benchmark itself does not allow this).
+//
+// Each string is represented by a record holding the next 8 characters
+// from the current depth packed into an integer, so that most steps
+// compare integers instead of following a pointer to the string:
+//
+//  - large sets of records are radix sorted on their cached keys in
+//    parallel, and each group with the same key is then sorted on the
+//    following 8 characters (an MSD radix sort on 8 byte digits),
+//  - small sets are sorted by a multikey quicksort on the cached keys,
+//    which also goes on to the next 8 characters in the equal part.
+//
+// A string ends where its cached key is padded with zeros, so strings
+// whose keys are equal and that all end within them are ordered by
+// length (the shorter one is a prefix of the longer one).  Characters
+// are compared as char, as by the comparison in sortTime.
+// **************************************************************
+
+namespace string_sort_internal {
+
+struct record {
+  uint64_t key;  // characters [depth, depth+8) of the string
+  uint32_t id;
+  uint32_t len;
+};
+
+template <typename Str>
+inline uint64_t load_key(Str const &s, size_t depth) {
+  // maps the order of char onto the order of unsigned bytes
+  constexpr uint64_t flip = std::is_signed_v<char> ? 0x8080808080808080ul : 0;
+  size_t n = s.size();
+  char const* p = s.data() + depth;
+  uint64_t k = 0;
+  if (depth + 8 <= n) {
+    std::memcpy(&k, p, 8);
+    return __builtin_bswap64(k) ^ flip;
+  }
+  for (size_t i = 0; i < 8; i++)
+    k = (k << 8) | (depth + i < n ? (uint8_t) p[i] ^ (uint8_t) flip : 0);
+  return k;
+}
+
+constexpr long parallel_cutoff = 1 << 14;
+constexpr long insertion_cutoff = 16;
+
+template <typename Str> void sort_from(parlay::slice<record*, record*> R,
+                                       parlay::sequence<Str> const &A, size_t depth);
+
+// sorts records whose keys are all equal at depth
+template <typename Str>
+void sort_equal(parlay::slice<record*, record*> R, parlay::sequence<Str> const &A, size_t depth) {
+  if (R.size() < 2) return;
+  bool longer = false;
+  for (auto &r : R) longer |= (r.len > depth + 8);
+  if (!longer) {
+    std::sort(R.begin(), R.end(), [] (record const &a, record const &b) {return a.len < b.len;});
+    return;
+  }
+  for (auto &r : R) r.key = load_key(A[r.id], depth + 8);
+  sort_from(R, A, depth + 8);
+}
+
+// multikey quicksort on the cached keys
+template <typename Str>
+void multikey_quicksort(record* a, long n, parlay::sequence<Str> const &A, size_t depth) {
+  while (n > insertion_cutoff) {
+    uint64_t x = a[0].key, y = a[n/2].key, z = a[n-1].key;
+    uint64_t p = std::max(std::min(x, y), std::min(std::max(x, y), z));
+    long lt = 0, i = 0, gt = n;
+    while (i < gt) {
+      if (a[i].key < p) std::swap(a[lt++], a[i++]);
+      else if (a[i].key > p) std::swap(a[i], a[--gt]);
+      else i++;
+    }
+    sort_equal(parlay::make_slice(a + lt, a + gt), A, depth);
+    if (lt < n - gt) {
+      multikey_quicksort(a, lt, A, depth);
+      a += gt; n -= gt;
+    } else {
+      multikey_quicksort(a + gt, n - gt, A, depth);
+      n = lt;
+    }
+  }
+  for (long i = 1; i < n; i++) {
+    record r = a[i];
+    long j = i;
+    for (; j > 0 && a[j-1].key > r.key; j--) a[j] = a[j-1];
+    a[j] = r;
+  }
+  for (long i = 0, j; i < n; i = j) {
+    for (j = i + 1; j < n && a[j].key == a[i].key; j++);
+    sort_equal(parlay::make_slice(a + i, a + j), A, depth);
+  }
+}
+
+// sorts records with cached keys at depth
+template <typename Str>
+void sort_from(parlay::slice<record*, record*> R, parlay::sequence<Str> const &A, size_t depth) {
+  long n = R.size();
+  if (n < parallel_cutoff) {
+    multikey_quicksort(R.begin(), n, A, depth);
+    return;
+  }
+  parlay::internal::integer_sort_inplace(R, [] (record const &r) {return r.key;}, 64);
+  auto starts = parlay::pack_index<long>(parlay::delayed_seq<bool>(n, [&] (long i) {
+    return i == 0 || R[i].key != R[i-1].key;}));
+  parlay::parallel_for(0, starts.size(), [&] (long i) {
+    long end = (i + 1 < (long) starts.size()) ? starts[i+1] : n;
+    sort_equal(R.cut(starts[i], end), A, depth);
+  }, 1);
+}
+
+}  // namespace string_sort_internal
+
+// sorts a sequence of strings (sequences of char) in place
+template <typename Str>
+void string_sort(parlay::sequence<Str> &A) {
+  using namespace string_sort_internal;
+  size_t n = A.size();
+  if (n > std::numeric_limits<uint32_t>::max()) {
+    std::cout << "string_sort: too many strings" << std::endl;
+    abort();
+  }
+  auto R = parlay::tabulate(n, [&] (size_t i) {
+    return record{load_key(A[i], 0), (uint32_t) i, (uint32_t) A[i].size()};});
+  sort_from(parlay::make_slice(R), A, 0);
+  A = parlay::tabulate(n, [&] (size_t i) {return std::move(A[R[i].id]);});
+}
@@ -37,11 +37,30 @@ struct heap_tree {
   // Finds a key in the "heap indexed" tree
   // If equal to pivot, then placed in bucket below (with less)
   template <typename Less>
-  inline int find(const T& key, const Less& less) {
+  inline int find(const T& key, const Less& less) const {
     long j = 0;
     for (int k = 0; k < levels+1; k++) {
       j = 1 + 2 * j + less(tree[j],key);
     }
     return j - size;
   }
+
+  // Finds the n keys starting at keys and writes their buckets to out.
+  // The keys are searched unroll at a time, level by level, so that the
+  // loads of the independent searches overlap (and for arithmetic keys
+  // the compiler can turn each level into vector compares).
+  static constexpr int unroll = 8;
+  template <typename It, typename Out, typename Less>
+  inline void find_n(It keys, long n, Out* out, const Less& less) const {
+    long i = 0;
+    for (; i + unroll <= n; i += unroll) {
+      long j[unroll];
+      for (int u = 0; u < unroll; u++) j[u] = 0;
+      for (int k = 0; k < levels+1; k++)
+        for (int u = 0; u < unroll; u++)
+          j[u] = 1 + 2 * j[u] + less(tree[j[u]], keys[i+u]);
+      for (int u = 0; u < unroll; u++) out[i+u] = j[u] - size;
+    }
+    for (; i < n; i++) out[i] = find(keys[i], less);
+  }
 };
@@ -1,6 +1,10 @@
 #include <algorithm>
+#include <atomic>
 #include <functional>
+#include <mutex>
 #include <random>
+#include <type_traits>
+#include <vector>
 
 #include <parlay/parallel.h>
 #include <parlay/primitives.h>
@@ -25,10 +29,197 @@
 // In particular this uses uninitialized sequences and relocation, which
 // avoids copying the keys.  Useful for strings.
 // Also uses parlay's internal quicksort (faster for strings)
+//
+// Unless the sort is stable, the keys are distributed into the buckets
+// in place, following IPS4o (Axtmann, Witt, Ferizovic and Sanders), so
+// that neither an array of bucket ids nor a second array of keys is
+// needed.  The stable sort uses a bucket id per key and a count sort.
 // **************************************************************
 
-template <typename assignment_tag, typename Range, typename Less>
-void sample_sort_(Range in, Range out, Less less, bool stable=false, int level=1) {
+// The block permutation state of a bucket: blocks [w, r] of its region
+// are still to be moved, and reading counts the blocks being moved out
+// of the region, whose slots may not be written until they are done.
+struct block_bucket {
+  std::mutex m;
+  long w, r;
+  std::atomic<long> reading{0};
+};
+
+// Partitions A in place into num_buckets buckets and returns the
+// offsets of the buckets (num_buckets+1 of them).  classify(first, m,
+// ids) sets the buckets of the m keys starting at first.  The keys are
+// moved in blocks of B.  It proceeds in four phases:
+//
+//  - each of a number of stripes of A is classified into a buffer
+//    block per bucket, and a buffer is written back to the front of the
+//    stripe whenever it fills, leaving the stripe with a prefix of
+//    blocks, each holding keys of a single bucket,
+//  - the region of each bucket, from its start rounded up to a block,
+//    is compacted so that the full blocks in it form a prefix,
+//  - the blocks are permuted into the regions of their buckets in
+//    parallel, each worker carrying a block to its bucket and taking
+//    the block it replaces along, with a lock per bucket,
+//  - the keys that the last block of a bucket put past its end, and the
+//    keys left in the buffers, are moved into the gaps at the start and
+//    end of each bucket.
+//
+// A block written past the end of A goes into an overflow block.
+template <typename Range, typename Classify>
+parlay::sequence<long> block_partition(Range A, long num_buckets, const Classify& classify) {
+  using T = typename Range::value_type;
+  long n = A.size();
+  long k = num_buckets;
+  long B = std::max<long>(1, 2048 / sizeof(T));
+  long nb = n / B;  // number of full block slots
+  long stripes = std::max<long>(1, std::min<long>(parlay::num_workers(), n / (4 * k * B)));
+  long sb = nb / stripes;  // blocks per stripe, the last one also gets the rest
+  T* a = &A[0];
+
+  auto buffers = parlay::internal::uninitialized_sequence<T>(stripes * k * B);
+  parlay::sequence<long> fill(stripes * k, 0);     // keys in each buffer
+  parlay::sequence<long> blocks(stripes * k, 0);   // blocks of each bucket written by each stripe
+  parlay::sequence<long> written(stripes);
+
+  parlay::parallel_for(0, stripes, [&] (long t) {
+    constexpr long batch = 256;
+    int ids[batch];
+    long start = t * sb * B;
+    long end = (t == stripes - 1) ? n : (t + 1) * sb * B;
+    T* buf = buffers.begin() + t * k * B;
+    long* f = fill.begin() + t * k;
+    long* c = blocks.begin() + t * k;
+    long w = start;
+    for (long i = start; i < end; i += batch) {
+      long m = std::min(batch, end - i);
+      classify(a + i, m, ids);
+      for (long j = 0; j < m; j++) {
+        long b = ids[j];
+        parlay::uninitialized_relocate(buf + b * B + f[b], a + i + j);
+        if (++f[b] == B) {
+          parlay::uninitialized_relocate_n(a + w, buf + b * B, B);
+          w += B;
+          f[b] = 0;
+          c[b]++;
+        }
+      }
+    }
+    written[t] = (w - start) / B;
+  }, 1);
+
+  // bucket offsets, and the first block slot of the region of each bucket
+  parlay::sequence<long> offsets(k + 1);
+  parlay::sequence<long> total_blocks(k);
+  parlay::parallel_for(0, k, [&] (long b) {
+    long size = 0, bl = 0;
+    for (long t = 0; t < stripes; t++) {
+      bl += blocks[t * k + b];
+      size += blocks[t * k + b] * B + fill[t * k + b];
+    }
+    offsets[b] = size;
+    total_blocks[b] = bl;
+  });
+  offsets[k] = 0;
+  parlay::scan_inplace(offsets);
+  auto first_slot = parlay::tabulate(k + 1, [&] (long b) {return (offsets[b] + B - 1) / B;});
+
+  auto full = [&] (long j) {
+    long t = (sb == 0) ? 0 : std::min(j / sb, stripes - 1);
+    return j < nb && j - t * sb < written[t];
+  };
+  std::vector<block_bucket> buckets(k);
+  parlay::parallel_for(0, k, [&] (long b) {
+    long lo = first_slot[b], hi = first_slot[b+1];
+    long count = 0;
+    for (long j = lo; j < hi; j++) count += full(j);
+    long l = lo, r = hi - 1;
+    while (true) {
+      while (l < hi && full(l)) l++;
+      while (r >= lo && !full(r)) r--;
+      if (l >= r) break;
+      parlay::uninitialized_relocate_n(a + l * B, a + r * B, B);
+      l++; r--;
+    }
+    buckets[b].w = lo;
+    buckets[b].r = lo + count - 1;
+  });
+
+  auto overflow = parlay::internal::uninitialized_sequence<T>(B);
+  bool used_overflow = false;
+  auto swaps = parlay::internal::uninitialized_sequence<T>(stripes * 2 * B);
+  parlay::parallel_for(0, stripes, [&] (long t) {
+    T* swap[2] = {swaps.begin() + 2 * t * B, swaps.begin() + (2 * t + 1) * B};
+    for (long i = 0; i < k; i++) {
+      block_bucket& src = buckets[(t * k / stripes + i) % k];
+      while (true) {
+        long s;
+        {
+          std::lock_guard<std::mutex> lock(src.m);
+          if (src.r < src.w) break;
+          s = src.r--;
+          src.reading++;
+        }
+        parlay::uninitialized_relocate_n(swap[0], a + s * B, B);
+        src.reading--;
+        int cur = 0;
+        while (true) {
+          int d;
+          classify(swap[cur], 1, &d);
+          block_bucket& dst = buckets[d];
+          long slot;
+          bool occupied;
+          {
+            std::lock_guard<std::mutex> lock(dst.m);
+            slot = dst.w++;
+            occupied = slot <= dst.r;
+          }
+          if (occupied) {
+            parlay::uninitialized_relocate_n(swap[1-cur], a + slot * B, B);
+            parlay::uninitialized_relocate_n(a + slot * B, swap[cur], B);
+            cur = 1 - cur;
+          } else {
+            while (dst.reading > 0) {}
+            if (slot == nb) {
+              parlay::uninitialized_relocate_n(overflow.begin(), swap[cur], B);
+              used_overflow = true;
+            } else parlay::uninitialized_relocate_n(a + slot * B, swap[cur], B);
+            break;
+          }
+        }
+      }
+    }
+  }, 1);
+
+  // where position p is after the permutation
+  auto at = [&] (long p) {
+    return (used_overflow && p >= nb * B) ? overflow.begin() + (p - nb * B) : a + p;
+  };
+  auto spill = parlay::internal::uninitialized_sequence<T>(k * B);
+  parlay::sequence<long> spilled(k, 0);
+  parlay::parallel_for(0, k, [&] (long b) {
+    long end = (first_slot[b] + total_blocks[b]) * B;
+    long from = std::max(offsets[b+1], first_slot[b] * B);
+    for (long p = from; p < end; p++)
+      parlay::uninitialized_relocate(spill.begin() + b * B + spilled[b]++, at(p));
+  });
+  if (used_overflow)
+    parlay::uninitialized_relocate_n(a + nb * B, overflow.begin(), n - nb * B);
+  parlay::parallel_for(0, k, [&] (long b) {
+    long lo = offsets[b], hi = offsets[b+1];
+    long end = std::max((first_slot[b] + total_blocks[b]) * B, lo);
+    long p = lo;
+    auto put = [&] (T* x) {
+      if (p == std::min(first_slot[b] * B, hi)) p = std::min(end, hi);
+      parlay::uninitialized_relocate(a + p++, x);
+    };
+    for (long j = 0; j < spilled[b]; j++) put(spill.begin() + b * B + j);
+    for (long t = 0; t < stripes; t++)
+      for (long j = 0; j < fill[t * k + b]; j++) put(buffers.begin() + (t * k + b) * B + j);
+  });
+  return offsets;
+}
+
+template <typename assignment_tag, typename InRange, typename Range, typename Less>
+void sample_sort_(InRange in, Range out, Less less, bool stable=false, int level=1) {
   long n = in.size();
   parlay::internal::timer t("sample", level==1);
   using T = typename Range::value_type;
@@ -38,8 +229,11 @@ void sample_sort_(Range in, Range out, Less less, bool stable=false, int level=1
   long cutoff = 1024;
   if (n <= cutoff || (level > 2)) { // && n <= 1 << 17)) {
     //return;
-    if (in.begin() != out.begin())
-      parlay::uninitialized_relocate_n(out.begin(), in.begin(), n);
+    if constexpr (std::is_same_v<assignment_tag, parlay::uninitialized_relocate_tag>) {
+      if (in.begin() != out.begin())
+	parlay::uninitialized_relocate_n(out.begin(), in.begin(), n);
+    } else
+      for (long i = 0; i < n; i++) parlay::assign_dispatch(out[i], in[i], assignment_tag());
     if (stable)
       std::stable_sort(out.begin(), out.end(), less);
     else
@@ -49,8 +243,19 @@ void sample_sort_(Range in, Range out, Less less, bool stable=false, int level=1
     return;
   }
 
+  // the non-stable sort of a separate output first copies the keys into
+  // it and then sorts them there in place
+  bool inplace = !stable;
+  if (inplace && in.begin() != out.begin()) {
+    parlay::parallel_for(0, n, [&] (long i) {
+      parlay::assign_dispatch(out[i], in[i], assignment_tag());});
+    sample_sort_<parlay::uninitialized_relocate_tag>(out, out, less, stable, level);
+    return;
+  }
+
   // number of bits in bucket count (e.g. 8 would mean 256 buckets)
-  int max_bits = (level == 1) ? 10 : 8;
+  // the in-place partition keeps a buffer block per bucket per stripe
+  int max_bits = (level == 1 && !inplace) ? 10 : 8;
   int bits = std::min<long>(max_bits, parlay::log2_up(n)-parlay::log2_up(cutoff)+1);
   long num_buckets = 1 << bits;
 
@@ -74,18 +279,39 @@ void sample_sort_(Range in, Range out, Less less, bool stable=false, int level=1
   for (int i=0; i < num_buckets-2; i++)
     if (!less(pivots[i],pivots[i+1])) duplicates = true;
   
-  // put pivots into efficient search tree and find buckets id for the input keys
+  // put pivots into efficient search tree to find the buckets of the keys
   heap_tree ss(pivots);
-  parlay::sequence<bucket_key_t> bucket_ids;
-  if (duplicates)
-    // if duplicates put keys equal to a pivot in next bucket
-    // this ensures all keys equaling a duplicate are in a bucket by themselves
-    bucket_ids = parlay::tabulate(n, [&] (long i) -> bucket_key_t {
-			  auto b = ss.find(in[i], less);
-			  return b + ((b < num_buckets-1) && !less(in[i],pivots[b]));}, 1000);
-  else
-    bucket_ids = parlay::tabulate(n, [&] (long i) -> bucket_key_t {
-				       return ss.find(in[i], less);}, 1000);
+  // if duplicates put keys equal to a pivot in next bucket
+  // this ensures all keys equaling a duplicate are in a bucket by themselves
+  auto classify = [&] (auto first, long m, auto* ids) {
+    ss.find_n(first, m, ids, less);
+    if (duplicates)
+      for (long j = 0; j < m; j++)
+	ids[j] += (ids[j] < num_buckets-1) && !less(first[j], pivots[ids[j]]);
+  };
+  // if duplicate keys among pivots don't sort all-equal buckets
+  auto needs_sort = [&] (long i) {
+    return i == 0 || i == num_buckets - 1 || less(pivots[i-1], pivots[i]);};
+
+  if (inplace) {
+    auto offsets = block_partition(out, num_buckets, classify);
+    t.next("block partition");
+    parlay::parallel_for(0, num_buckets, [&] (long i) {
+      long first = offsets[i];
+      long last = offsets[i+1];
+      if (last-first > 1 && needs_sort(i))
+	sample_sort_<parlay::uninitialized_relocate_tag>(out.cut(first,last), out.cut(first,last),
+							 less, stable, level+1);
+    }, 1);
+    return;
+  }
+
+  auto bucket_ids = parlay::sequence<bucket_key_t>::uninitialized(n);
+  long block = 1024;
+  parlay::parallel_for(0, (n + block - 1) / block, [&] (long i) {
+    long first = i * block;
+    classify(in.begin() + first, std::min(block, n - first), bucket_ids.begin() + first);
+  }, 1);
   t.next("bucket id");
    
   // sort into the buckets
@@ -100,8 +326,7 @@ void sample_sort_(Range in, Range out, Less less, bool stable=false, int level=1
     long first = offsets[i];
     long last = offsets[i+1];
     if (last-first == 0) return; // empty
-    // if duplicate keys among pivots don't sort all-equal buckets
-    if (i == 0 || i == num_buckets - 1 || less(pivots[i-1], pivots[i]))
+    if (needs_sort(i))
       sample_sort_<parlay::uninitialized_relocate_tag>(keys_slice.cut(first,last), out.cut(first,last),
 						       less, stable, level+1);
     else parlay::uninitialized_relocate_n(out.begin()+first, keys_slice.begin()+first, last-first);
@@ -109,7 +334,8 @@ void sample_sort_(Range in, Range out, Less less, bool stable=false, int level=1
 }
 
 // A version that returns sequence in the input.
-// It does use O(n) temporary memory.
+// It uses temporary memory proportional to the number of workers times
+// the number of buckets, not to n.
 template <typename Range, typename Less = std::less<>>
 void sample_sort_inplace(Range& in, Less less = {}) {
   auto ins = parlay::make_slice(in);
@@ -1,3 +1,4 @@
 #include "parlay/primitives.h"
 
-parlay::sequence<uint> histogram(parlay::sequence<uint> const &In, uint buckets);
+parlay::sequence<uint> histogram(parlay::sequence<uint> const &In, uint buckets,
+				 bool verbose);
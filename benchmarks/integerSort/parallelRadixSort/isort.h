@@ -1,13 +1,263 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#if defined(__SSE2__) && defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#include "parlay/parallel.h"
 #include "parlay/primitives.h"
+#include "parlay/sequence.h"
+#include "parlay/utilities.h"
+
+// **************************************************************
+// A stable radix sort that adapts to the keys it is given:
+//
+//  - the keys are first scanned in parallel for their range, and are
+//    sorted as key - min on the bits needed for max - min (the bits
+//    argument is only an upper bound and is not relied on),
+//  - if the keys fit in one pass, or two passes whose buckets would not
+//    fit in cache, it does LSD passes over the whole input,
+//  - otherwise it does an MSD pass on the top digit and sorts each
+//    bucket on the remaining bits, in cache once it is small enough,
+//  - passes over large inputs go through a small write combining buffer
+//    per bucket, and if the output is larger than the cache the buffers
+//    are written with non-temporal stores.
+//
+// Keys can be any integers up to 64 bits, signed or not, and elements
+// can be pairs with a payload of any size as long as they can be
+// copied as bytes.
+// **************************************************************
+
+namespace isort_internal {
+
+// order preserving map from an integer key to an unsigned 64 bit one
+template <class K>
+inline uint64_t ukey(K k) {
+  static_assert(std::is_integral<K>::value, "integer sort needs integer keys");
+  if constexpr (std::is_signed<K>::value)
+    return ((uint64_t) (int64_t) k) ^ (((uint64_t) 1) << 63);
+  else return (uint64_t) k;
+}
+
+constexpr int max_digit = 10;               // bits per pass
+constexpr size_t in_cache = 1 << 19;        // bytes to sort without leaving the cache
+constexpr size_t seq_cutoff = 1 << 14;      // elements sorted sequentially
+constexpr size_t wc_bytes = 64;             // write combining buffer per bucket
+constexpr size_t stream_bytes = 1 << 25;    // outputs larger than this bypass the cache
+
+// copies m elements to dst, with non-temporal stores if stream is set
+template <class T>
+inline void write_out(T* dst, T const* src, size_t m, bool stream) {
+#if defined(__SSE2__) && defined(__x86_64__)
+  if (stream) {
+    char const* s = (char const*) src;
+    char* d = (char*) dst;
+    if constexpr (sizeof(T) % 8 == 0 && alignof(T) >= 8) {
+      for (size_t i = 0; i < m * sizeof(T); i += 8) {
+	long long w;
+	std::memcpy(&w, s + i, 8);
+	_mm_stream_si64((long long*) (d + i), w);
+      }
+      return;
+    } else if constexpr (sizeof(T) % 4 == 0 && alignof(T) >= 4) {
+      for (size_t i = 0; i < m * sizeof(T); i += 4) {
+	int w;
+	std::memcpy(&w, s + i, 4);
+	_mm_stream_si32((int*) (d + i), w);
+      }
+      return;
+    }
+  }
+#endif
+  std::memcpy((void*) dst, (void const*) src, m * sizeof(T));
+}
+
+inline void stream_fence() {
+#if defined(__SSE2__) && defined(__x86_64__)
+  _mm_sfence();
+#endif
+}
+
+// Stable counting sort of src[0,n) into dst on the digit of b bits at
+// shift.  Returns the start of each bucket in dst (and n at the end).
+template <class T, class Key>
+parlay::sequence<size_t> seq_pass(T const* src, T* dst, size_t n, Key const& key,
+				  int shift, int b) {
+  size_t buckets = ((size_t) 1) << b, mask = buckets - 1;
+  parlay::sequence<size_t> starts(buckets + 1, 0);
+  for (size_t i = 0; i < n; i++) starts[((key(src[i]) >> shift) & mask) + 1]++;
+  for (size_t j = 0; j < buckets; j++) starts[j+1] += starts[j];
+  auto offsets = starts;
+  for (size_t i = 0; i < n; i++)
+    std::memcpy((void*) (dst + offsets[(key(src[i]) >> shift) & mask]++),
+		(void const*) (src + i), sizeof(T));
+  return starts;
+}
+
+// as seq_pass, in parallel over blocks of the input, each of which
+// scatters through write combining buffers
+template <class T, class Key>
+parlay::sequence<size_t> par_pass(T const* src, T* dst, size_t n, Key const& key,
+				  int shift, int b, bool stream) {
+  size_t buckets = ((size_t) 1) << b, mask = buckets - 1;
+  size_t block_size = std::max(seq_cutoff, n / (8 * parlay::num_workers()) + 1);
+  size_t nb = (n + block_size - 1) / block_size;
+  parlay::sequence<size_t> counts(nb * buckets, 0);
+  parlay::parallel_for(0, nb, [&] (size_t k) {
+    size_t* c = counts.begin() + k * buckets;
+    for (size_t i = k * block_size; i < std::min(n, (k+1) * block_size); i++)
+      c[(key(src[i]) >> shift) & mask]++;
+  }, 1);
+
+  parlay::sequence<size_t> starts(buckets + 1);
+  size_t s = 0;
+  for (size_t j = 0; j < buckets; j++) {
+    starts[j] = s;
+    for (size_t k = 0; k < nb; k++) {
+      size_t c = counts[k * buckets + j];
+      counts[k * buckets + j] = s;
+      s += c;
+    }
+  }
+  starts[buckets] = n;
+
+  constexpr size_t w = std::max<size_t>(1, wc_bytes / sizeof(T));
+  parlay::parallel_for(0, nb, [&] (size_t k) {
+    size_t* offsets = counts.begin() + k * buckets;
+    size_t e = std::min(n, (k+1) * block_size);
+    if constexpr (w == 1) {
+      for (size_t i = k * block_size; i < e; i++)
+	write_out(dst + offsets[(key(src[i]) >> shift) & mask]++, src + i, 1, stream);
+    } else {
+      auto buffer = parlay::sequence<T>::uninitialized(buckets * w);
+      parlay::sequence<unsigned char> fill(buckets, 0);
+      for (size_t i = k * block_size; i < e; i++) {
+	size_t j = (key(src[i]) >> shift) & mask;
+	T* buf = buffer.begin() + j * w;
+	std::memcpy((void*) (buf + fill[j]), (void const*) (src + i), sizeof(T));
+	if (++fill[j] == w) {
+	  write_out(dst + offsets[j], buf, w, stream);
+	  offsets[j] += w;
+	  fill[j] = 0;
+	}
+      }
+      for (size_t j = 0; j < buckets; j++)
+	write_out(dst + offsets[j], buffer.begin() + j * w, fill[j], false);
+    }
+    if (stream) stream_fence();
+  }, 1);
+  return starts;
+}
+
+template <class T, class Key>
+parlay::sequence<size_t> pass(T const* src, T* dst, size_t n, Key const& key,
+			      int shift, int b, bool stream) {
+  if (n <= seq_cutoff) return seq_pass(src, dst, n, key, shift, b);
+  return par_pass(src, dst, n, key, shift, b, stream);
+}
+
+template <class T>
+void copy_elements(T const* src, T* dst, size_t n) {
+  parlay::parallel_for(0, (n + seq_cutoff - 1) / seq_cutoff, [&] (size_t k) {
+    size_t s = k * seq_cutoff;
+    std::memcpy((void*) (dst + s), (void const*) (src + s),
+		std::min(seq_cutoff, n - s) * sizeof(T));
+  }, 1);
+}
+
+// LSD sort of src[0,n) on the low bits of their keys into dst, with tmp
+// as scratch.  src can be dst, tmp or a separate array.
+template <class T, class Key>
+void lsd(T const* src, T* dst, T* tmp, size_t n, Key const& key, int bits, bool stream) {
+  int passes = (bits + max_digit - 1) / max_digit;
+  if (passes == 0) {
+    if (src != dst) copy_elements(src, dst, n);
+    return;
+  }
+  // the last pass writes to dst, unless the first would then write to src
+  T* out[2] = {dst, tmp};
+  bool back = (out[(passes - 1) % 2] == src);
+  if (back) std::swap(out[0], out[1]);
+  int shift = 0;
+  for (int i = 0; i < passes; i++) {
+    int b = (bits - shift) / (passes - i);
+    T* target = out[(passes - 1 - i) % 2];
+    pass(i == 0 ? src : out[(passes - i) % 2], target, n, key, shift, b, stream);
+    shift += b;
+  }
+  if (back) copy_elements(tmp, dst, n);
+}
+
+// MSD sort of src[0,n) on the low bits of their keys into dst, with tmp
+// as scratch: partitions on the top digit and sorts each bucket, by LSD
+// once it fits in cache or has a single digit left.
+template <class T, class Key>
+void msd(T const* src, T* dst, T* tmp, size_t n, Key const& key, int bits, bool stream) {
+  if (n * sizeof(T) <= in_cache || bits <= max_digit) {
+    lsd(src, dst, tmp, n, key, bits, stream && n * sizeof(T) > stream_bytes);
+    return;
+  }
+  int low = bits - max_digit;
+  T* target = (src == tmp) ? dst : tmp;
+  T* other = (target == tmp) ? dst : tmp;
+  auto starts = pass(src, target, n, key, low, max_digit, stream);
+  parlay::parallel_for(0, starts.size() - 1, [&] (size_t j) {
+    size_t s = starts[j], m = starts[j+1] - s;
+    if (target == dst) msd(dst + s, dst + s, other + s, m, key, low, false);
+    else msd(target + s, dst + s, target + s, m, key, low, false);
+  }, 1);
+}
+
+// sorts In stably on g(x) and returns the result
+template <class T, class G>
+parlay::sequence<T> sort(parlay::slice<T*,T*> In, G const& g) {
+  static_assert(std::is_trivially_copy_constructible<T>::value &&
+		std::is_trivially_destructible<T>::value,
+		"integer sort copies elements as bytes");
+  size_t n = In.size();
+  T const* A = In.begin();
+  if (n == 0) return parlay::sequence<T>();
+
+  size_t nb = std::min((n + seq_cutoff - 1) / seq_cutoff, 4 * parlay::num_workers());
+  size_t block_size = (n + nb - 1) / nb;
+  parlay::sequence<std::pair<uint64_t, uint64_t>> ranges(nb);
+  parlay::parallel_for(0, nb, [&] (size_t k) {
+    uint64_t lo = ~(uint64_t) 0, hi = 0;
+    for (size_t i = k * block_size; i < std::min(n, (k+1) * block_size); i++) {
+      uint64_t x = ukey(g(A[i]));
+      lo = std::min(lo, x);
+      hi = std::max(hi, x);
+    }
+    ranges[k] = std::make_pair(lo, hi);
+  }, 1);
+  uint64_t lo = ~(uint64_t) 0, hi = 0;
+  for (auto [l, h] : ranges) {lo = std::min(lo, l); hi = std::max(hi, h);}
+  int bits = 0;
+  while (bits < 64 && ((hi - lo) >> bits) != 0) bits++;
+  auto key = [&] (T const& x) {return ukey(g(x)) - lo;};
+
+  auto Out = parlay::sequence<T>::uninitialized(n);
+  parlay::sequence<T> Tmp;
+  if (bits > max_digit) Tmp = parlay::sequence<T>::uninitialized(n);
+  bool stream = n * sizeof(T) > stream_bytes;
+  int passes = (bits + max_digit - 1) / max_digit;
+  bool use_msd = passes >= 3 ||
+    (passes == 2 && ((n * sizeof(T)) >> max_digit) <= in_cache);
+  if (use_msd) msd(A, Out.begin(), Tmp.begin(), n, key, bits, stream);
+  else lsd(A, Out.begin(), Tmp.begin(), n, key, bits, stream);
+  return Out;
+}
+
+}  // namespace isort_internal
 
 template <class T>
 auto int_sort(parlay::slice<T*,T*> In, size_t bits) {
-  auto f = [&] (T x) {return x;};
-  return parlay::internal::integer_sort(parlay::make_slice(In), f, bits);
+  return isort_internal::sort(In, [] (T const& x) {return x;});
 }
 
 template <class E, class F>
 auto int_sort(parlay::slice<std::pair<E,F>*, std::pair<E,F>*> In, size_t bits) {
-  auto f = [&] (std::pair<E,F> x) {return x.first;};
-  return parlay::internal::integer_sort(parlay::make_slice(In), f, bits);
+  return isort_internal::sort(In, [] (std::pair<E,F> const& x) {return x.first;});
 }
@@ -0,0 +1,533 @@
+// This code is part of the Problem Based Benchmark Suite (PBBS)
+// Copyright (c) 2011 Guy Blelloch and the PBBS team
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights (to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include "parlay/parallel.h"
+#include "parlay/primitives.h"
+#include "parlay/sequence.h"
+#include "parlay/io.h"
+#include "index.h"
+
+// **************************************************************
+// A compressed inverted index:
+//
+//  - the terms are sorted and front coded in buckets of 16: the first
+//    term of a bucket is stored whole, each other one as the length of
+//    the prefix it shares with the previous term and the rest of it,
+//    so a term is found by a binary search on the first terms of the
+//    buckets and a scan of one bucket,
+//  - the posting list of a term is its sorted document ids as gaps,
+//    with full blocks of 128 gaps bit packed at the width of their
+//    largest gap (as in BP128, without its SIMD lane order) and the
+//    rest in variable byte code, preceded by the last id and offset of
+//    each block so that an intersection can skip the blocks it does
+//    not need.
+//
+// Lists are encoded in parallel over terms and the sections of the
+// binary file are written in parallel.
+// **************************************************************
+
+namespace postings {
+
+using bytes = parlay::sequence<uint8_t>;
+using doc_list = parlay::sequence<uint32_t>;
+
+constexpr size_t block = 128;   // gaps per bit packed block
+constexpr size_t bucket = 16;   // terms per front coded bucket
+constexpr char magic[9] = "PBBSIDX1";
+
+inline void put_varbyte(bytes &out, uint64_t x) {
+  for (; x >= 128; x >>= 7) out.push_back((uint8_t) (x | 128));
+  out.push_back((uint8_t) x);
+}
+
+inline uint64_t get_varbyte(uint8_t const* &p) {
+  uint64_t x = 0;
+  int shift = 0;
+  for (; *p & 128; shift += 7) x |= ((uint64_t) (*p++ & 127)) << shift;
+  return x | (((uint64_t) *p++) << shift);
+}
+
+inline void put_u32(bytes &out, uint32_t x) {
+  for (int i = 0; i < 4; i++) out.push_back((uint8_t) (x >> (8 * i)));
+}
+
+inline uint32_t get_u32(uint8_t const* p) {
+  uint32_t x;
+  std::memcpy(&x, p, 4);
+  return x;
+}
+
+// a byte with the width b, then the 128 values in b bits each
+inline void pack_block(bytes &out, uint32_t const* v) {
+  uint32_t m = 0;
+  for (size_t i = 0; i < block; i++) m |= v[i];
+  int b = (m == 0) ? 0 : 32 - __builtin_clz(m);
+  out.push_back((uint8_t) b);
+  uint64_t buf = 0;
+  int bits = 0;
+  for (size_t i = 0; i < block; i++) {
+    buf |= ((uint64_t) v[i]) << bits;
+    for (bits += b; bits >= 8; bits -= 8, buf >>= 8) out.push_back((uint8_t) buf);
+  }
+}
+
+inline uint8_t const* unpack_block(uint8_t const* p, uint32_t* v) {
+  int b = *p++;
+  uint64_t mask = (((uint64_t) 1) << b) - 1;
+  uint64_t buf = 0;
+  int bits = 0;
+  for (size_t i = 0; i < block; i++) {
+    for (; bits < b; bits += 8) buf |= ((uint64_t) *p++) << bits;
+    v[i] = (uint32_t) (buf & mask);
+    buf >>= b;
+    bits -= b;
+  }
+  return p;
+}
+
+// ids must be sorted and distinct
+inline bytes encode(doc_list const &ids) {
+  size_t n = ids.size(), nb = n / block;
+  auto gap = [&] (size_t i) {return (i == 0) ? ids[0] : ids[i] - ids[i-1] - 1;};
+  bytes blocks;
+  doc_list offsets(nb);
+  uint32_t g[block];
+  for (size_t k = 0; k < nb; k++) {
+    offsets[k] = (uint32_t) blocks.size();
+    for (size_t i = 0; i < block; i++) g[i] = gap(k * block + i);
+    pack_block(blocks, g);
+  }
+  bytes out;
+  for (size_t k = 0; k < nb; k++) {
+    put_u32(out, ids[(k + 1) * block - 1]);
+    put_u32(out, offsets[k]);
+  }
+  out.append(blocks);
+  for (size_t i = nb * block; i < n; i++) put_varbyte(out, gap(i));
+  return out;
+}
+
+// A posting list in place: the skip entries (last id and offset of
+// each full block), the blocks, and the rest in variable byte code.
+struct list_view {
+  uint8_t const* p;
+  uint32_t n;
+
+  size_t blocks() const {return n / block;}
+  size_t chunks() const {return (n + block - 1) / block;}
+  uint32_t last(size_t k) const {return get_u32(p + 8 * k);}
+  uint8_t const* block_start(size_t k) const {
+    return p + 8 * blocks() + get_u32(p + 8 * k + 4);
+  }
+  uint8_t const* tail_start() const {
+    size_t nb = blocks();
+    if (nb == 0) return p;
+    uint8_t const* q = block_start(nb - 1);
+    return q + 1 + 16 * (*q);
+  }
+
+  // decodes the k-th chunk of up to 128 ids into out, returning their number
+  size_t decode_chunk(size_t k, uint32_t* out) const {
+    uint32_t base = (k == 0) ? 0 : last(k - 1) + 1;
+    if (k < blocks()) {
+      unpack_block(block_start(k), out);
+      out[0] += base;
+      for (size_t i = 1; i < block; i++) out[i] += out[i-1] + 1;
+      return block;
+    }
+    uint8_t const* q = tail_start();
+    size_t m = n - blocks() * block;
+    for (size_t i = 0; i < m; i++)
+      out[i] = ((i == 0) ? base : out[i-1] + 1) + (uint32_t) get_varbyte(q);
+    return m;
+  }
+
+  doc_list decode() const {
+    auto out = doc_list::uninitialized(n);
+    for (size_t k = 0; k < chunks(); k++) decode_chunk(k, out.begin() + k * block);
+    return out;
+  }
+};
+
+// first i in [lo, hi) with get(i) >= x, or hi, by doubling steps from lo
+template <class Get>
+size_t gallop(Get const &get, size_t lo, size_t hi, uint32_t x) {
+  if (lo >= hi || get(lo) >= x) return lo;
+  size_t step = 1;
+  while (lo + step < hi && get(lo + step) < x) {lo += step; step *= 2;}
+  hi = std::min(hi, lo + step);
+  // get(lo) < x and get(hi) >= x (if hi is in range)
+  while (hi - lo > 1) {
+    size_t mid = (lo + hi) / 2;
+    if (get(mid) < x) lo = mid; else hi = mid;
+  }
+  return hi;
+}
+
+// the ids of a (sorted) that are also in l, decoding only the blocks
+// of l that may hold them
+inline doc_list intersect(doc_list const &a, list_view l) {
+  doc_list r;
+  uint32_t buf[block];
+  size_t nb = l.blocks(), chunks = l.chunks();
+  size_t cur = 0, decoded = chunks, m = 0, j = 0;
+  auto last = [&] (size_t k) {return l.last(k);};
+  auto get = [&] (size_t i) {return buf[i];};
+  for (uint32_t x : a) {
+    // the tail, if any, holds ids above all blocks
+    if (cur < nb) cur = gallop(last, cur, nb, x);
+    if (cur == chunks) break;
+    if (cur != decoded) {m = l.decode_chunk(cur, buf); decoded = cur; j = 0;}
+    j = gallop(get, j, m, x);
+    if (j < m && buf[j] == x) r.push_back(x);
+  }
+  return r;
+}
+
+inline doc_list unite(doc_list const &a, doc_list const &b) {
+  doc_list r(a.size() + b.size());
+  auto e = std::set_union(a.begin(), a.end(), b.begin(), b.end(), r.begin());
+  r.resize(e - r.begin());
+  return r;
+}
+
+// The front coded terms: dict holds the buckets, starting at
+// bucket_offsets, and n is the number of terms.
+struct dict_view {
+  uint8_t const* dict;
+  uint64_t const* bucket_offsets;
+  size_t n;
+
+  size_t buckets() const {return (n + bucket - 1) / bucket;}
+
+  // the terms in order, from the start of a bucket
+  struct cursor {
+    dict_view const* d;
+    size_t i;
+    uint8_t const* p;
+    charseq w;
+
+    bool done() const {return i >= d->n;}
+    void load() {
+      size_t shared = 0;
+      if (i % bucket == 0) p = d->dict + d->bucket_offsets[i / bucket];
+      else shared = get_varbyte(p);
+      size_t len = get_varbyte(p);
+      w.resize(shared);
+      w.append(parlay::make_slice((char const*) p, (char const*) p + len));
+      p += len;
+    }
+    void next() {if (++i < d->n) load();}
+  };
+
+  cursor at_bucket(size_t b) const {
+    cursor c{this, b * bucket, nullptr, charseq()};
+    if (!c.done()) c.load();
+    return c;
+  }
+
+  // the last bucket whose first term is <= w, or 0
+  size_t bucket_of(charseq const &w) const {
+    auto first_after = [&] (size_t b) {  // first term of bucket b > w
+      uint8_t const* p = dict + bucket_offsets[b];
+      size_t len = get_varbyte(p);
+      return std::lexicographical_compare(w.begin(), w.end(), p, p + len);
+    };
+    size_t lo = 0, hi = buckets();
+    while (hi - lo > 1) {
+      size_t mid = (lo + hi) / 2;
+      if (first_after(mid)) hi = mid; else lo = mid;
+    }
+    return lo;
+  }
+
+  // a cursor at the first term >= w
+  cursor seek(charseq const &w) const {
+    cursor c = at_bucket(bucket_of(w));
+    while (!c.done() && c.w < w) c.next();
+    return c;
+  }
+
+  charseq term(size_t t) const {
+    cursor c = at_bucket(t / bucket);
+    while (c.i < t) c.next();
+    return c.w;
+  }
+
+  // the id of the term w, or -1 if it is not in the index
+  long find(charseq const &w) const {
+    cursor c = seek(w);
+    return (!c.done() && c.w == w) ? (long) c.i : -1;
+  }
+};
+
+struct section_header {
+  char magic[8];
+  uint64_t num_docs;
+  uint64_t num_terms;
+  uint64_t dict_bytes;
+  uint64_t data_bytes;
+};
+
+// An index file, in place in a mapping of it: the header, then the
+// bucket offsets, the term offsets, the counts, the dictionary and the
+// lists, each starting at a multiple of 8 bytes.
+struct index_file {
+  parlay::file_map F;
+  section_header h;
+  uint64_t const* bucket_offsets;
+  uint64_t const* offsets;
+  uint32_t const* counts;
+  uint8_t const* dict;
+  uint8_t const* data;
+
+  index_file(char const* fileName) : F(fileName) {
+    char const* start = F.begin();
+    if (F.size() < sizeof(h) || std::memcmp(start, magic, 8) != 0) {
+      std::cout << "Not an index file: " << fileName << std::endl;
+      abort();
+    }
+    std::memcpy(&h, start, sizeof(h));
+    size_t pos = 0;
+    auto take = [&] (size_t bytes) {
+      pos = (pos + 7) / 8 * 8;
+      if (pos + bytes > F.size()) {
+	std::cout << "Index file is truncated: " << fileName << std::endl;
+	abort();
+      }
+      char const* r = start + pos;
+      pos += bytes;
+      return r;
+    };
+    take(sizeof(h));
+    bucket_offsets = (uint64_t const*) take(8 * num_buckets());
+    offsets = (uint64_t const*) take(8 * (h.num_terms + 1));
+    counts = (uint32_t const*) take(4 * h.num_terms);
+    dict = (uint8_t const*) take(h.dict_bytes);
+    data = (uint8_t const*) take(h.data_bytes);
+  }
+
+  size_t num_terms() const {return h.num_terms;}
+  size_t num_buckets() const {return (h.num_terms + bucket - 1) / bucket;}
+  list_view list(size_t t) const {return list_view{data + offsets[t], counts[t]};}
+  dict_view dictionary() const {return dict_view{dict, bucket_offsets, num_terms()};}
+};
+
+struct inverted_index {
+  uint64_t num_docs = 0;
+  parlay::sequence<uint64_t> bucket_offsets;  // into dict, per bucket of terms
+  parlay::sequence<uint64_t> offsets;         // into data, per term and the end
+  doc_list counts;                            // ids per term
+  bytes dict;
+  bytes data;
+
+  size_t num_terms() const {return counts.size();}
+  size_t num_postings() const {return parlay::reduce(parlay::delayed_map(counts, [] (uint32_t c) {return (size_t) c;}));}
+  size_t size_in_bytes() const {
+    return dict.size() + data.size() + 8 * (bucket_offsets.size() + offsets.size()) + 4 * counts.size();
+  }
+
+  list_view list(size_t t) const {return list_view{data.begin() + offsets[t], counts[t]};}
+  dict_view dictionary() const {return dict_view{dict.begin(), bucket_offsets.begin(), num_terms()};}
+  charseq term(size_t t) const {return dictionary().term(t);}
+  long find(charseq const &w) const {return dictionary().find(w);}
+
+  // from the terms in order, given by term(i), and their encoded lists
+  template <class Term>
+  static inverted_index assemble(Term const &term, parlay::sequence<bytes> const &lists,
+				 doc_list counts, uint64_t num_docs) {
+    inverted_index I;
+    size_t n = lists.size(), nb = (n + bucket - 1) / bucket;
+    I.num_docs = num_docs;
+    I.counts = std::move(counts);
+    I.offsets = parlay::tabulate(n + 1, [&] (size_t i) {return (uint64_t) (i < n ? lists[i].size() : 0);});
+    parlay::scan_inplace(I.offsets);
+    I.data = parlay::flatten(lists);
+
+    auto buckets = parlay::tabulate(nb, [&] (size_t b) {
+      bytes out;
+      for (size_t i = b * bucket; i < std::min(n, (b + 1) * bucket); i++) {
+	charseq const &w = term(i);
+	size_t shared = 0;
+	if (i > b * bucket) {
+	  charseq const &prev = term(i-1);
+	  while (shared < std::min(w.size(), prev.size()) && w[shared] == prev[shared]) shared++;
+	  put_varbyte(out, shared);
+	}
+	put_varbyte(out, w.size() - shared);
+	out.append(w.cut(shared, w.size()));
+      }
+      return out;}, 1);
+    I.bucket_offsets = parlay::tabulate(nb, [&] (size_t b) {return (uint64_t) buckets[b].size();});
+    parlay::scan_inplace(I.bucket_offsets);
+    I.dict = parlay::flatten(buckets);
+    return I;
+  }
+
+  // words must be sorted by term, with the ids of each sorted and distinct
+  static inverted_index build(parlay::sequence<std::pair<charseq, doc_list>> const &words,
+			      uint64_t num_docs) {
+    auto lists = parlay::tabulate(words.size(), [&] (size_t i) {
+      return encode(words[i].second);}, 1);
+    auto counts = parlay::tabulate(words.size(), [&] (size_t i) {
+      return (uint32_t) words[i].second.size();});
+    return assemble([&] (size_t i) -> charseq const& {return words[i].first;},
+		    lists, std::move(counts), num_docs);
+  }
+
+  void write(char const* fileName) const {
+    section_header h;
+    std::memcpy(h.magic, magic, 8);
+    h.num_docs = num_docs;
+    h.num_terms = num_terms();
+    h.dict_bytes = dict.size();
+    h.data_bytes = data.size();
+    struct section {char const* p; size_t n;};
+    section sections[] = {{(char const*) &h, sizeof(h)},
+			  {(char const*) bucket_offsets.begin(), 8 * bucket_offsets.size()},
+			  {(char const*) offsets.begin(), 8 * offsets.size()},
+			  {(char const*) counts.begin(), 4 * counts.size()},
+			  {(char const*) dict.begin(), dict.size()},
+			  {(char const*) data.begin(), data.size()}};
+    size_t ns = sizeof(sections) / sizeof(section);
+    parlay::sequence<size_t> starts(ns + 1, 0);
+    for (size_t i = 0; i < ns; i++) starts[i+1] = (starts[i] + sections[i].n + 7) / 8 * 8;
+
+    int fd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || ftruncate(fd, starts[ns]) != 0) {
+      std::cout << "Unable to write file: " << fileName << std::endl;
+      abort();
+    }
+    constexpr size_t chunk = 1 << 24;
+    std::atomic<bool> failed = false;
+    parlay::parallel_for(0, ns, [&] (size_t i) {
+      parlay::parallel_for(0, (sections[i].n + chunk - 1) / chunk, [&] (size_t k) {
+	size_t len = std::min(chunk, sections[i].n - k * chunk);
+	if (pwrite(fd, sections[i].p + k * chunk, len, starts[i] + k * chunk) != (ssize_t) len)
+	  failed = true;
+      }, 1);
+    }, 1);
+    close(fd);
+    if (failed) {
+      std::cout << "Unable to write file: " << fileName << std::endl;
+      abort();
+    }
+  }
+
+  static inverted_index read(char const* fileName) {
+    index_file f(fileName);
+    inverted_index I;
+    I.num_docs = f.h.num_docs;
+    size_t n = f.num_terms();
+    I.bucket_offsets = parlay::tabulate(f.num_buckets(), [&] (size_t i) {return f.bucket_offsets[i];});
+    I.offsets = parlay::tabulate(n + 1, [&] (size_t i) {return f.offsets[i];});
+    I.counts = parlay::tabulate(n, [&] (size_t i) {return f.counts[i];});
+    I.dict = parlay::tabulate(f.h.dict_bytes, [&] (size_t i) {return f.dict[i];});
+    I.data = parlay::tabulate(f.h.data_bytes, [&] (size_t i) {return f.data[i];});
+    return I;
+  }
+};
+
+// Merges runs whose documents are in increasing ranges (the ids of run
+// i are all below those of run i+1), so that the list of a term is the
+// lists of the runs that have it one after the other.  The term space
+// is split by terms sampled from the runs, and each part is merged in
+// parallel with a cursor per run.
+inline inverted_index merge_runs(parlay::sequence<index_file const*> const &runs) {
+  size_t k = runs.size();
+  size_t total = 0;
+  uint64_t num_docs = 0;
+  for (auto r : runs) {total += r->num_terms(); num_docs = std::max(num_docs, r->h.num_docs);}
+  auto dicts = parlay::tabulate(k, [&] (size_t r) {return runs[r]->dictionary();});
+
+  size_t parts = std::min<size_t>(total / 4096 + 1, 8 * parlay::num_workers());
+  auto samples = parlay::flatten(parlay::tabulate(k, [&] (size_t r) {
+    size_t nb = dicts[r].buckets();
+    return parlay::tabulate(std::min(nb, parts), [&] (size_t j) {
+      return dicts[r].at_bucket(j * nb / std::min(nb, parts)).w;});}));
+  parlay::sort_inplace(samples);
+  // equal splitters just leave empty parts
+  auto splitters = parlay::tabulate(samples.size() == 0 ? 0 : parts - 1, [&] (size_t j) {
+    return samples[(j + 1) * samples.size() / parts];});
+
+  struct part {
+    parlay::sequence<charseq> terms;
+    parlay::sequence<bytes> lists;
+    doc_list counts;
+  };
+  size_t np = splitters.size() + 1;
+  auto merged = parlay::tabulate(np, [&] (size_t j) {
+    part P;
+    auto cursors = parlay::tabulate(k, [&] (size_t r) {
+      return (j == 0) ? dicts[r].at_bucket(0) : dicts[r].seek(splitters[j-1]);});
+    auto in_part = [&] (size_t r) {
+      return !cursors[r].done() && (j == np - 1 || cursors[r].w < splitters[j]);};
+    while (true) {
+      long m = -1;
+      for (size_t r = 0; r < k; r++)
+	if (in_part(r) && (m == -1 || cursors[r].w < cursors[m].w)) m = r;
+      if (m == -1) break;
+      charseq w = cursors[m].w;
+      doc_list ids;
+      for (size_t r = m; r < k; r++)
+	if (in_part(r) && cursors[r].w == w) {
+	  ids.append(runs[r]->list(cursors[r].i).decode());
+	  cursors[r].next();
+	}
+      P.counts.push_back((uint32_t) ids.size());
+      P.lists.push_back(encode(ids));
+      P.terms.push_back(std::move(w));
+    }
+    return P;}, 1);
+
+  auto terms = parlay::flatten(parlay::map(merged, [] (part const &P) {return P.terms;}));
+  auto lists = parlay::flatten(parlay::map(merged, [] (part const &P) {return P.lists;}));
+  auto counts = parlay::flatten(parlay::map(merged, [] (part const &P) {return P.counts;}));
+  merged.clear();
+  return inverted_index::assemble([&] (size_t i) -> charseq const& {return terms[i];},
+				  lists, std::move(counts), num_docs);
+}
+
+}  // namespace postings
+
+// builds the compressed index of the documents of s, each of which
+// starts with doc_start
+postings::inverted_index build_compressed_index(charseq const &s, charseq const &doc_start,
+						bool verbose);
+
+// as build_compressed_index, on the documents of a file, taking chunks
+// of them whose partial index fits in about memory bytes, writing each
+// to run_prefix.<i> and merging them
+postings::inverted_index build_compressed_index_chunked(char const* fileName,
+							charseq const &doc_start,
+							size_t memory,
+							std::string const &run_prefix,
+							bool verbose);
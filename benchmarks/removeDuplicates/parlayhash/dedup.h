@@ -1,6 +1,219 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "parlay/parallel.h"
 #include "parlay/primitives.h"
+#include "parlay/sequence.h"
+#include "parlay/utilities.h"
+#include "common/atomics.h"
+
+// **************************************************************
+// Removes duplicates by inserting every element into a concurrent hash
+// set, so that the input is read once more after sizing the table
+// (rather than sorted in several passes):
+//
+//  - the number of distinct elements is first estimated with a
+//    HyperLogLog sketch, and the table is sized for a load of about 0.7
+//    (if the estimate was too low and the table fills up, it is
+//    rebuilt twice as large),
+//  - 4 and 8 byte elements (ints, longs and pairs of ints) are stored
+//    in place in a linear probing table of words claimed with a CAS,
+//  - strings are stored as indices into the input, in groups of 16
+//    slots with a byte of the hash of each as a tag, so that a probe
+//    compares the tags of a group at once and only compares strings
+//    whose tags match,
+//  - other elements go to parlay::remove_duplicates.
+//
+// The result is in no particular order.
+// **************************************************************
+
+namespace dedup_internal {
+
+// estimates the number of distinct values of hash(i) for i in [0, n)
+template <class Hash>
+double distinct_estimate(size_t n, Hash const& hash) {
+  constexpr int b = 12;
+  constexpr size_t m = 1 << b;
+  size_t nb = std::min<size_t>(n / 65536 + 1, 4 * parlay::num_workers());
+  size_t block_size = (n + nb - 1) / nb;
+  parlay::sequence<uint8_t> regs(nb * m, 0);
+  parlay::parallel_for(0, nb, [&] (size_t k) {
+    uint8_t* r = regs.begin() + k * m;
+    for (size_t i = k * block_size; i < std::min(n, (k+1) * block_size); i++) {
+      uint64_t h = hash(i);
+      uint8_t rank = __builtin_clzll((h << b) | (((uint64_t) 1) << (b - 1))) + 1;
+      r[h >> (64 - b)] = std::max(r[h >> (64 - b)], rank);
+    }
+  }, 1);
+  double sum = 0;
+  size_t zeros = 0;
+  for (size_t j = 0; j < m; j++) {
+    uint8_t r = 0;
+    for (size_t k = 0; k < nb; k++) r = std::max(r, regs[k * m + j]);
+    sum += std::ldexp(1.0, -r);
+    zeros += (r == 0);
+  }
+  double e = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+  if (e <= 2.5 * m && zeros > 0) e = m * std::log((double) m / zeros);
+  return e;
+}
+
+// maps a hash onto [0, n)
+inline size_t reduce_range(uint64_t h, size_t n) {
+  return (size_t) (((unsigned __int128) h * n) >> 64);
+}
+
+inline size_t table_size(double estimate, size_t n) {
+  // leaves room for the error of the sketch
+  return std::max<size_t>(64, std::min<double>(n, 1.1 * estimate) / 0.7);
+}
+
+inline uint64_t string_hash(char const* s, size_t n) {
+  uint64_t h = n;
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t w;
+    std::memcpy(&w, s + i, 8);
+    h = (h ^ w) * 0x9E3779B97F4A7C15ul;
+    h ^= h >> 29;
+  }
+  uint64_t w = 0;
+  if (i < n) std::memcpy(&w, s + i, n - i);
+  return parlay::hash64_2(h ^ w);
+}
+
+// elements of 4 or 8 bytes, as words in a linear probing table
+template <class T>
+parlay::sequence<T> dedup_words(parlay::sequence<T> const &A) {
+  using W = std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>;
+  constexpr W empty = ~(W) 0;
+  size_t n = A.size();
+  auto word = [&] (size_t i) {W w; std::memcpy(&w, &A[i], sizeof(W)); return w;};
+  auto hash = [&] (W w) {return parlay::hash64_2(w);};
+  size_t m = table_size(distinct_estimate(n, [&] (size_t i) {return hash(word(i));}), n);
+
+  while (true) {
+    auto table = parlay::sequence<W>(m, empty);
+    std::atomic<bool> has_empty = false;  // the key that is the empty word
+    std::atomic<bool> full = false;
+    parlay::parallel_for(0, n, [&] (size_t i) {
+      if (full.load(std::memory_order_relaxed)) return;
+      W w = word(i);
+      if (w == empty) {
+	if (!has_empty.load(std::memory_order_relaxed)) has_empty = true;
+	return;
+      }
+      size_t j = reduce_range(hash(w), m);
+      for (size_t probes = 0; probes < m; probes++) {
+	W v = __atomic_load_n(&table[j], __ATOMIC_RELAXED);
+	if (v == w) return;
+	if (v == empty) {
+	  if (pbbs::atomic_compare_and_swap(&table[j], empty, w)) return;
+	  if (__atomic_load_n(&table[j], __ATOMIC_RELAXED) == w) return;
+	}
+	if (++j == m) j = 0;
+      }
+      full = true;
+    });
+    if (full) {m *= 2; continue;}
+    auto kept = parlay::filter(table, [&] (W w) {return w != empty;});
+    size_t extra = has_empty ? 1 : 0;
+    return parlay::tabulate(kept.size() + extra, [&] (size_t i) {
+      T r;
+      W w = (i < kept.size()) ? kept[i] : empty;
+      std::memcpy((void*) &r, &w, sizeof(W));
+      return r;});
+  }
+}
+
+// strings, as indices into A in groups of 16 tagged slots
+template <class Str>
+parlay::sequence<Str> dedup_strings(parlay::sequence<Str> const &A) {
+  constexpr size_t group = 16;
+  constexpr size_t empty = ~(size_t) 0;
+  size_t n = A.size();
+  auto H = parlay::tabulate(n, [&] (size_t i) {return string_hash(A[i].begin(), A[i].size());});
+  size_t groups = table_size(distinct_estimate(n, [&] (size_t i) {return H[i];}), n) / group + 1;
+
+  while (true) {
+    size_t m = groups * group;
+    auto slots = parlay::sequence<size_t>(m, empty);
+    auto tags = parlay::sequence<uint8_t>(m, 0);
+    std::atomic<bool> full = false;
+    auto same = [&] (size_t i, size_t j) {
+      return H[i] == H[j] && A[i].size() == A[j].size() &&
+	std::memcmp(A[i].begin(), A[j].begin(), A[i].size()) == 0;};
+    parlay::parallel_for(0, n, [&] (size_t i) {
+      if (full.load(std::memory_order_relaxed)) return;
+      uint8_t tag = 0x80 | (H[i] & 0x7f);
+      size_t g = reduce_range(H[i], groups);
+      for (size_t probes = 0; probes < groups; probes++) {
+	uint8_t* t = tags.begin() + g * group;
+	// slots whose tag is either ours or not yet set (a tag only changes
+	// once, from 0, so one being set while the group is read is seen
+	// either way, and its slot is checked if it is seen as 0)
+#if defined(__SSE2__)
+	__m128i ts = _mm_loadu_si128((__m128i const*) t);
+	unsigned mask = _mm_movemask_epi8(
+	  _mm_or_si128(_mm_cmpeq_epi8(ts, _mm_set1_epi8((char) tag)),
+		       _mm_cmpeq_epi8(ts, _mm_setzero_si128())));
+#else
+	unsigned mask = 0;
+	for (size_t k = 0; k < group; k++)
+	  mask |= (unsigned) (t[k] == tag || t[k] == 0) << k;
+#endif
+	for (; mask != 0; mask &= mask - 1) {
+	  size_t k = g * group + __builtin_ctz(mask);
+	  size_t j = __atomic_load_n(&slots[k], __ATOMIC_ACQUIRE);
+	  if (j == empty) {
+	    if (pbbs::atomic_compare_and_swap(&slots[k], empty, i)) {
+	      __atomic_store_n(&tags[k], tag, __ATOMIC_RELEASE);
+	      return;
+	    }
+	    j = __atomic_load_n(&slots[k], __ATOMIC_ACQUIRE);
+	  }
+	  if (same(i, j)) return;
+	}
+	if (++g == groups) g = 0;
+      }
+      full = true;
+    });
+    if (full) {groups *= 2; continue;}
+    auto kept = parlay::filter(slots, [&] (size_t j) {return j != empty;});
+    return parlay::tabulate(kept.size(), [&] (size_t i) {return A[kept[i]];});
+  }
+}
+
+template <class T>
+struct is_word_pair : std::false_type {};
+
+template <class A, class B>
+struct is_word_pair<std::pair<A,B>> : std::bool_constant<
+  std::is_integral<A>::value && std::is_integral<B>::value &&
+  sizeof(std::pair<A,B>) == sizeof(A) + sizeof(B)> {};
+
+template <class T>
+struct is_char_seq : std::false_type {};
+
+template <>
+struct is_char_seq<parlay::sequence<char>> : std::true_type {};
+
+}  // namespace dedup_internal
 
 template <class T>
 parlay::sequence<T> dedup(parlay::sequence<T> const &A) {
-  return parlay::remove_duplicates(A);
+  using namespace dedup_internal;
+  if constexpr ((std::is_integral<T>::value || is_word_pair<T>::value) &&
+		(sizeof(T) == 4 || sizeof(T) == 8))
+    return dedup_words(A);
+  else if constexpr (is_char_seq<T>::value)
+    return dedup_strings(A);
+  else return parlay::remove_duplicates(A);
 }
@@ -27,6 +27,13 @@
 #include <string>
 #include <string>
 #include <cstring>
+#include <charconv>
+#include <memory>
+#include <thread>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "../parlay/primitives.h"
 #include "../parlay/parallel.h"
 #include "../parlay/io.h"
@@ -79,23 +86,78 @@ namespace benchIO {
   inline void xToString(char* s, charstring const &a) {
     for (int i=0; i < a.size(); i++) s[i] = a[i];}
 
-  inline int xToStringLen(long a) { return 21;}
-  inline void xToString(char* s, long a) { sprintf(s,"%ld",a);}
+  // Each xToStringLen returns exactly the number of characters the
+  // matching xToString writes, so a sequence is formatted in two
+  // passes (lengths, then characters) with no padding to squeeze out.
 
-  inline int xToStringLen(unsigned long a) { return 21;}
-  inline void xToString(char* s, unsigned long a) { sprintf(s,"%lu",a);}
+  static const char digitPairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
 
-  inline uint xToStringLen(uint a) { return 12;}
-  inline void xToString(char* s, uint a) { sprintf(s,"%u",a);}
+  // number of decimal digits in x, without a loop
+  inline int numDigits(uint64_t x) {
+    static const uint64_t powers[20] = {
+      0, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull,
+      100000000ull, 1000000000ull, 10000000000ull, 100000000000ull,
+      1000000000000ull, 10000000000000ull, 100000000000000ull,
+      1000000000000000ull, 10000000000000000ull, 100000000000000000ull,
+      1000000000000000000ull, 10000000000000000000ull};
+    int t = ((64 - __builtin_clzll(x | 1)) * 1233) >> 12;
+    return t - (x < powers[t]) + 1;
+  }
+
+  // writes the len = numDigits(x) digits of x, two at a time from the end
+  inline void writeDigits(char* s, uint64_t x, int len) {
+    char* p = s + len;
+    while (x >= 100) {
+      p -= 2;
+      memcpy(p, digitPairs + 2 * (x % 100), 2);
+      x /= 100;
+    }
+    if (x >= 10) memcpy(p - 2, digitPairs + 2 * x, 2);
+    else p[-1] = (char) ('0' + x);
+  }
+
+  inline int unsignedLen(uint64_t a) {return numDigits(a);}
+  inline void unsignedToString(char* s, uint64_t a) {
+    writeDigits(s, a, numDigits(a));}
+
+  inline int signedLen(int64_t a) {
+    return (a < 0) + numDigits(a < 0 ? 0 - (uint64_t) a : a);}
+  inline void signedToString(char* s, int64_t a) {
+    if (a < 0) {*s++ = '-'; unsignedToString(s, 0 - (uint64_t) a);}
+    else unsignedToString(s, a);
+  }
 
-  inline int xToStringLen(int a) { return 12;}
-  inline void xToString(char* s, int a) { sprintf(s,"%d",a);}
+  inline int xToStringLen(long a) { return signedLen(a);}
+  inline void xToString(char* s, long a) { signedToString(s, a);}
 
-  inline int xToStringLen(double a) { return 18;}
-  inline void xToString(char* s, double a) { sprintf(s,"%.11le", a);}
+  inline int xToStringLen(unsigned long a) { return unsignedLen(a);}
+  inline void xToString(char* s, unsigned long a) { unsignedToString(s, a);}
 
-  inline int xToStringLen(char* a) { return strlen(a)+1;}
-  inline void xToString(char* s, char* a) { sprintf(s,"%s",a);}
+  inline uint xToStringLen(uint a) { return unsignedLen(a);}
+  inline void xToString(char* s, uint a) { unsignedToString(s, a);}
+
+  inline int xToStringLen(int a) { return signedLen(a);}
+  inline void xToString(char* s, int a) { signedToString(s, a);}
+
+  // Floating point values are written in the shortest form that reads
+  // back to the same value (std::to_chars, which uses Ryu).
+  inline int xToStringLen(double a) {
+    char buf[32];
+    return std::to_chars(buf, buf + 32, a).ptr - buf;}
+  inline void xToString(char* s, double a) {
+    std::to_chars(s, s + 32, a);}
+
+  inline int xToStringLen(float a) {
+    char buf[32];
+    return std::to_chars(buf, buf + 32, a).ptr - buf;}
+  inline void xToString(char* s, float a) {
+    std::to_chars(s, s + 32, a);}
+
+  inline int xToStringLen(char* a) { return strlen(a);}
+  inline void xToString(char* s, char* a) { memcpy(s, a, strlen(a));}
 
   template <class A, class B>
   inline int xToStringLen(pair<A,B> a) { 
@@ -110,61 +172,173 @@ namespace benchIO {
     xToString(s+l+1, a.second);
   }
 
+  // Formats one element per line, followed by a terminating 0
+  // (which is not written out).
   template <class Seq>
   charstring seqToString(Seq const &A) {
     size_t n = A.size();
-    auto L = parlay::tabulate(n, [&] (size_t i) -> long {
+    auto L = parlay::tabulate(n + 1, [&] (size_t i) -> size_t {
+	if (i == n) return 0;
 	typename Seq::value_type x = A[i];
 	return xToStringLen(x)+1;});
-    size_t m;
-    std::tie(L,m) = parlay::scan(std::move(L));
+    size_t m = parlay::scan_inplace(L);
 
-    charstring B(m+1, (char) 0);
+    auto B = charstring::uninitialized(m+1);
     char* Bs = B.begin();
 
-    parlay::parallel_for(0, n-1, [&] (long i) {
+    parlay::parallel_for(0, n, [&] (size_t i) {
       xToString(Bs + L[i], A[i]);
       Bs[L[i+1] - 1] = '\n';
       });
-    xToString(Bs + L[n-1], A[n-1]);
-    Bs[m] = Bs[m-1] = '\n';
-    
-    charstring C = parlay::filter(B, [&] (char c) {return c != 0;}); 
-    C[C.size()-1] = 0;
-    return C;
+    Bs[m] = 0;
+    return B;
+  }
+
+  // **************************************************************
+  //    BINARY SEQUENCES
+  // **************************************************************
+
+  // Writers switch to a binary format when the output file name ends
+  // in ".bin".  A binary sequence is a 64 byte header, holding the
+  // text header of the sequence (e.g. "sequenceInt"), followed by the
+  // raw little endian elements.  The readers recognize the format by
+  // its magic number.
+  constexpr char binSeqMagic[8] = "PBBSSEQ";
+  constexpr uint32_t binSeqVersion = 1;
+
+  struct binSeqHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t elementBytes;
+    uint64_t n;
+    uint32_t isFloat;       // 1 if elements are floating point
+    uint32_t isSigned;      // 1 if elements are signed integers
+    char type[32];          // text header, zero padded
+  };
+
+  bool isBinaryFileName(char const *fileName) {
+    size_t l = strlen(fileName);
+    return l >= 4 && strcmp(fileName + l - 4, ".bin") == 0;
   }
 
+  // How an element is stored: trivially copyable elements as their
+  // bytes, and pairs as their two members one after the other (without
+  // any padding between them).  The flags of the header describe the
+  // first member of a pair.
+  template <class T>
+  struct binaryElement {
+    static constexpr bool ok = std::is_trivially_copyable<T>::value;
+    static constexpr bool raw = true;
+    static constexpr size_t bytes = sizeof(T);
+    using scalar = T;
+    static void put(char* p, T const &x) {memcpy(p, (void const*) &x, sizeof(T));}
+    static void get(char const* p, T &x) {memcpy((void*) &x, p, sizeof(T));}
+  };
+
+  template <class A, class B>
+  struct binaryElement<pair<A,B>> {
+    using EA = binaryElement<A>;
+    using EB = binaryElement<B>;
+    static constexpr bool ok = EA::ok && EB::ok;
+    static constexpr bool raw = false;
+    static constexpr size_t bytes = EA::bytes + EB::bytes;
+    using scalar = typename EA::scalar;
+    static void put(char* p, pair<A,B> const &x) {
+      EA::put(p, x.first);
+      EB::put(p + EA::bytes, x.second);
+    }
+    static void get(char const* p, pair<A,B> &x) {
+      EA::get(p, x.first);
+      EB::get(p + EA::bytes, x.second);
+    }
+  };
+
+  template <class T>
+  void writeBinarySeqToStream(ofstream& os, string const &header,
+			      parlay::sequence<T> const &A) {
+    using E = binaryElement<T>;
+    static_assert(E::ok, "binary output requires trivially copyable elements");
+    binSeqHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, binSeqMagic, 8);
+    h.version = binSeqVersion;
+    h.elementBytes = E::bytes;
+    h.n = A.size();
+    h.isFloat = std::is_floating_point<typename E::scalar>::value;
+    h.isSigned = std::is_signed<typename E::scalar>::value && !h.isFloat;
+    strncpy(h.type, header.c_str(), sizeof(h.type) - 1);
+    os.write((char const*) &h, sizeof(h));
+    if constexpr (E::raw) {
+      os.write((char const*) A.begin(), A.size() * sizeof(T));
+    } else {
+      // packed a block at a time
+      size_t n = A.size();
+      size_t bsize = 1 << 20;
+      auto buffer = parlay::sequence<char>::uninitialized(min(n, bsize) * E::bytes);
+      for (size_t s = 0; s < n; s += bsize) {
+	size_t e = min(n, s + bsize);
+	parlay::parallel_for(s, e, [&] (size_t i) {
+	    E::put(buffer.begin() + (i - s) * E::bytes, A[i]);});
+	os.write(buffer.begin(), (e - s) * E::bytes);
+      }
+    }
+  }
+
+  // Bound on the memory used by writeSeqToStream for formatted text
+  // (the block being written plus the one being formatted).
+  size_t outputMemoryCap = ((size_t) 1) << 28;
+
+  // Formats the sequence a block at a time.  While a block is being
+  // formatted (in parallel) the previous one is written out by a
+  // separate thread, so formatting and disk I/O overlap.  After each
+  // block the block size is adjusted so a formatted block, with its
+  // offsets, takes about half of outputMemoryCap.
   template <class T>
   void writeSeqToStream(ofstream& os, parlay::sequence<T> const &A) {
-    size_t bsize = 10000000;
-    size_t offset = 0;
     size_t n = A.size();
+    size_t offset = 0;
+    size_t bsize = 1 << 20;
+    charstring pending;
+    std::thread writer;
     while (offset < n) {
-      // Generates a string for a sequence of size at most bsize
-      // and then wrties it to the output stream
-      charstring S = seqToString(A.cut(offset, min(offset + bsize, n)));
-      os.write(S.begin(), S.size()-1);
-      offset += bsize;
+      size_t end = min(offset + bsize, n);
+      charstring S = seqToString(A.cut(offset, end));
+      if (writer.joinable()) writer.join();
+      pending = std::move(S);
+      writer = std::thread([&os, &pending] {
+	  os.write(pending.begin(), pending.size()-1);});
+      double bytes_per = (double) pending.size() / (end - offset) + sizeof(size_t);
+      bsize = std::max<size_t>(1, (size_t) (outputMemoryCap / 2 / bytes_per));
+      offset = end;
     }
+    if (writer.joinable()) writer.join();
   }
 
   template <class T>
   int writeSeqToFile(string header,
 		     parlay::sequence<T> const &A,
 		     char const *fileName) {
-    auto a = A[0];
-    //xToStringLena(a);
     ofstream file (fileName, ios::out | ios::binary);
     if (!file.is_open()) {
       std::cout << "Unable to open file: " << fileName << std::endl;
       return 1;
     }
-    file << header << endl;
-    writeSeqToStream(file, A);
+    if (isBinaryFileName(fileName)) {
+      if constexpr (binaryElement<T>::ok)
+	writeBinarySeqToStream(file, header, A);
+      else {
+	std::cout << "Binary output not supported for: " << fileName << std::endl;
+	abort();
+      }
+    } else {
+      file << header << endl;
+      writeSeqToStream(file, A);
+    }
     file.close();
     return 0;
   }
 
+  // in binary the two sequences are written as consecutive records
   template <class T1, class T2>
   int write2SeqToFile(string header,
 		      parlay::sequence<T1> const &A,
@@ -175,9 +349,19 @@ namespace benchIO {
       std::cout << "Unable to open file: " << fileName << std::endl;
       return 1;
     }
-    file << header << endl;
-    writeSeqToStream(file, A);
-    writeSeqToStream(file, B);
+    if (isBinaryFileName(fileName)) {
+      if constexpr (binaryElement<T1>::ok && binaryElement<T2>::ok) {
+	writeBinarySeqToStream(file, header, A);
+	writeBinarySeqToStream(file, header, B);
+      } else {
+	std::cout << "Binary output not supported for: " << fileName << std::endl;
+	abort();
+      }
+    } else {
+      file << header << endl;
+      writeSeqToStream(file, A);
+      writeSeqToStream(file, B);
+    }
     file.close();
     return 0;
   }
@@ -197,6 +381,133 @@ namespace benchIO {
     return bytes;
   }
 
+  // A private (copy-on-write) memory mapping of a whole file.  Pages
+  // are only read from disk when touched, and writes are never
+  // carried back to the file.  Unmapped when the last reference goes.
+  struct mappedFile {
+    char* start;
+    size_t size;
+    mappedFile(char* start, size_t size) : start(start), size(size) {}
+    ~mappedFile() {if (size > 0) munmap(start, size);}
+  };
+
+  std::shared_ptr<mappedFile> mmapFile(char const *fileName) {
+    int fd = open(fileName, O_RDONLY);
+    if (fd == -1) {
+      std::cout << "Unable to open file: " << fileName << std::endl;
+      abort();
+    }
+    struct stat sb;
+    if (fstat(fd, &sb) == -1 || !S_ISREG(sb.st_mode)) {
+      std::cout << "Not a regular file: " << fileName << std::endl;
+      abort();
+    }
+    size_t n = sb.st_size;
+    char* p = nullptr;
+    if (n > 0) {
+      p = static_cast<char*>(mmap(0, n, PROT_READ | PROT_WRITE,
+				  MAP_PRIVATE, fd, 0));
+      if (p == MAP_FAILED) {
+	std::cout << "Unable to mmap file: " << fileName << std::endl;
+	abort();
+      }
+    }
+    close(fd);
+    return std::make_shared<mappedFile>(p, n);
+  }
+
+  // Reads entry i of an array whose entries are the given number of
+  // bytes, converting to T.  Used when a binary file was written with
+  // a different width than the one requested.
+  template <class T>
+  T binaryEntry(char const *p, size_t i, uint32_t bytes,
+		bool isFloat, bool isSigned) {
+    if (isFloat) {
+      if (bytes == 4) return (T) ((float const*) p)[i];
+      return (T) ((double const*) p)[i];
+    }
+    if (!isSigned) switch (bytes) {
+    case 1: return (T) ((uint8_t const*) p)[i];
+    case 2: return (T) ((uint16_t const*) p)[i];
+    case 4: return (T) ((uint32_t const*) p)[i];
+    default: return (T) ((uint64_t const*) p)[i];
+    }
+    switch (bytes) {
+    case 1: return (T) ((int8_t const*) p)[i];
+    case 2: return (T) ((int16_t const*) p)[i];
+    case 4: return (T) ((int32_t const*) p)[i];
+    default: return (T) ((int64_t const*) p)[i];
+    }
+  }
+
+  // true if the file starts with the given 8 byte magic number
+  bool fileHasMagic(char const *fileName, char const *magic) {
+    char buf[8] = {0};
+    ifstream file (fileName, ios::in | ios::binary);
+    if (!file.is_open()) return false;
+    file.read(buf, 8);
+    return file.gcount() == 8 && memcmp(buf, magic, 8) == 0;
+  }
+
+  bool isBinarySeqFile(char const *fileName) {
+    return fileHasMagic(fileName, binSeqMagic);}
+
+  // the text header stored in a binary sequence file
+  string binarySeqType(char const *fileName) {
+    binSeqHeader h;
+    ifstream file (fileName, ios::in | ios::binary);
+    file.read((char*) &h, sizeof(h));
+    if (file.gcount() != sizeof(h)) return "";
+    h.type[sizeof(h.type) - 1] = 0;
+    return string(h.type);
+  }
+
+  // Reads the first record of a binary sequence file, checking it has
+  // the expected text header.  Arithmetic elements are converted if
+  // they were written with a different width, other elements must
+  // match exactly.
+  template <class T>
+  parlay::sequence<T> readBinarySeqFromFile(char const *fileName,
+					    string const &header) {
+    auto F = mmapFile(fileName);
+    binSeqHeader h;
+    if (F->size < sizeof(h)) {
+      cout << "Bad binary sequence file: too short" << endl;
+      abort();
+    }
+    memcpy(&h, F->start, sizeof(h));
+    h.type[sizeof(h.type) - 1] = 0;
+    if (memcmp(h.magic, binSeqMagic, 8) != 0 || h.version != binSeqVersion) {
+      cout << "Bad binary sequence file: wrong magic number or version" << endl;
+      abort();
+    }
+    if (header != h.type) {
+      cout << "bad header: expected " << header << " got " << h.type << endl;
+      abort();
+    }
+    if (F->size < sizeof(h) + h.n * h.elementBytes) {
+      cout << "Bad binary sequence file: too short" << endl;
+      abort();
+    }
+    char const* data = F->start + sizeof(h);
+    using E = binaryElement<T>;
+    if (h.elementBytes == E::bytes &&
+	(bool) h.isFloat == std::is_floating_point<typename E::scalar>::value) {
+      auto A = parlay::sequence<T>::uninitialized(h.n);
+      parlay::parallel_for(0, h.n, [&] (size_t i) {
+	  E::get(data + i * E::bytes, A[i]);});
+      return A;
+    }
+    if constexpr (std::is_arithmetic<T>::value) {
+      return parlay::tabulate(h.n, [&] (size_t i) -> T {
+	  return binaryEntry<T>(data, i, h.elementBytes, h.isFloat, h.isSigned);});
+    } else {
+      cout << "Bad binary sequence file: element size " << h.elementBytes
+	   << " does not match " << E::bytes << endl;
+      abort();
+    }
+  }
+
   string intHeaderIO = "sequenceInt";
 
   template <class T>
@@ -214,18 +525,165 @@ namespace benchIO {
     return r;
   }
 
+  // **************************************************************
+  //    FAST NUMBER PARSING
+  // **************************************************************
+
+  // Converts eight ascii digits, loaded little endian into a word,
+  // to their value using three multiplies (SWAR).
+  inline uint32_t parseEightDigits(uint64_t v) {
+    const uint64_t mask = 0x000000FF000000FFull;
+    const uint64_t mul1 = 100 + (1000000ull << 32);
+    const uint64_t mul2 = 1 + (10000ull << 32);
+    v -= 0x3030303030303030ull;
+    v = (v * 10) + (v >> 8);
+    v = (((v & mask) * mul1) + (((v >> 16) & mask) * mul2)) >> 32;
+    return (uint32_t) v;
+  }
+
+  inline bool isEightDigits(uint64_t v) {
+    return !(((v + 0x4646464646464646ull) | (v - 0x3030303030303030ull)) &
+	     0x8080808080808080ull);
+  }
+
+  inline bool isDigit(char c) {return c >= '0' && c <= '9';}
+
+  // accumulates the decimal digits starting at s (and before e) into r,
+  // eight at a time when possible, returning a pointer past the last one
+  inline char const* readDigits(char const* s, char const* e, uint64_t &r) {
+    uint64_t v;
+    while (s + 8 <= e && (memcpy(&v, s, 8), isEightDigits(v))) {
+      r = r * 100000000 + parseEightDigits(v);
+      s += 8;
+    }
+    while (s < e && isDigit(*s)) r = r * 10 + (*s++ - '0');
+    return s;
+  }
+
+  template <class T>
+  inline T parseInt(char const* s, char const* e) {
+    bool neg = false;
+    if (s < e && (*s == '-' || *s == '+')) neg = (*s++ == '-');
+    uint64_t r = 0;
+    readDigits(s, e, r);
+    return neg ? (T) (-(int64_t) r) : (T) r;
+  }
+
+  // Uses the exact fast path (at most 19 digits, and a power of ten
+  // that is exactly representable) which covers everything our
+  // generators write, and falls back on strtod otherwise.
+  inline double parseDouble(char const* s, char const* e) {
+    static const double powers[] = {
+      1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    char const* start = s;
+    bool neg = false;
+    if (s < e && (*s == '-' || *s == '+')) neg = (*s++ == '-');
+    uint64_t mant = 0;
+    char const* d = s;
+    s = readDigits(s, e, mant);
+    long digits = s - d;
+    long exp = 0;
+    if (s < e && *s == '.') {
+      d = ++s;
+      s = readDigits(s, e, mant);
+      digits += s - d;
+      exp = d - s;
+    }
+    if (s < e && (*s == 'e' || *s == 'E'))
+      exp += parseInt<long>(s + 1, e);
+    if (digits > 0 && digits <= 19 && mant < (1ull << 53) &&
+	exp >= -22 && exp <= 22) {
+      double r = (double) mant;
+      r = (exp < 0) ? r / powers[-exp] : r * powers[exp];
+      return neg ? -r : r;
+    }
+    std::string w(start, e);
+    return strtod(w.c_str(), nullptr);
+  }
+
+  template <class T>
+  inline T parseNumber(char const* s, char const* e) {
+    if constexpr (std::is_floating_point<T>::value)
+      return (T) parseDouble(s, e);
+    else return parseInt<T>(s, e);
+  }
+
+  // Indexes the whitespace separated words of a character buffer
+  // without materializing them.  The buffer is cut into blocks and
+  // each word is assigned to the block it starts in, so the words can
+  // be visited in parallel knowing their index in the whole buffer.
+  // The buffer must outlive the textWords.
+  struct textWords {
+    char const* s;
+    size_t n;
+    size_t block_size;
+    parlay::sequence<size_t> offsets; // index of first word of each block
+    size_t num_words;
+
+    bool is_start(size_t i) const {
+      return !is_space(s[i]) && (i == 0 || is_space(s[i-1]));}
+
+    textWords(char const* s, size_t n, size_t block_size = (1 << 16))
+      : s(s), n(n), block_size(block_size) {
+      size_t num_blocks = (n + block_size - 1) / block_size;
+      offsets = parlay::tabulate(num_blocks, [&] (size_t b) -> size_t {
+	  size_t cnt = 0;
+	  size_t end = std::min(n, (b + 1) * block_size);
+	  for (size_t i = b * block_size; i < end; i++) cnt += is_start(i);
+	  return cnt;});
+      num_words = parlay::scan_inplace(offsets);
+    }
+
+    size_t size() const {return num_words;}
+
+    // Calls f(i, start, end) for each word i in [first, last).
+    template <class F>
+    void apply(size_t first, size_t last, F f) const {
+      size_t num_blocks = offsets.size();
+      parlay::parallel_for(0, num_blocks, [&] (size_t b) {
+	  size_t j = offsets[b];
+	  size_t bend = (b + 1 == num_blocks) ? num_words : offsets[b+1];
+	  if (bend <= first || j >= last) return;
+	  size_t end = std::min(n, (b + 1) * block_size);
+	  for (size_t i = b * block_size; i < end && j < last; i++)
+	    if (is_start(i)) {
+	      size_t k = i + 1;
+	      while (k < n && !is_space(s[k])) k++;
+	      if (j >= first) f(j, s + i, s + k);
+	      j++;
+	      i = k - 1;
+	    }
+	}, 1);
+    }
+
+    template <class T>
+    parlay::sequence<T> parse(size_t first, size_t last) const {
+      auto R = parlay::sequence<T>::uninitialized(last - first);
+      apply(first, last, [&] (size_t i, char const* b, char const* e) {
+	  R[i - first] = parseNumber<T>(b, e);});
+      return R;
+    }
+
+    std::string word(size_t i) const {
+      std::string r;
+      apply(i, i + 1, [&] (size_t, char const* b, char const* e) {
+	  r = std::string(b, e);});
+      return r;
+    }
+  };
+
   template <class T>
   parlay::sequence<T> readIntSeqFromFile(char const *fileName) {
-    auto W = get_tokens(fileName);
-    string header(W[0].begin(),W[0].end());
-    if (header != intHeaderIO) {
+    if (isBinarySeqFile(fileName))
+      return readBinarySeqFromFile<T>(fileName, intHeaderIO);
+    auto F = mmapFile(fileName);
+    textWords W(F->start, F->size);
+    if (W.size() == 0 || W.word(0) != intHeaderIO) {
       cout << "readIntSeqFromFile: bad input" << endl;
       abort();
     }
-    long n = W.size()-1;
-    auto A = parlay::tabulate(n, [&] (long i) -> T {
-	return parlay::chars_to_long(W[i+1]);});
-    return A;
+    return W.parse<T>(1, W.size());
   }
 };
 
@@ -86,13 +86,13 @@ namespace benchIO {
     return r;
   }
 
-  template <class Point, class Seq>
-  parlay::sequence<Point> parsePoints(Seq W) {
+  // parses the points from words [first, last) of W
+  template <class Point>
+  parlay::sequence<Point> parsePoints(textWords const &W, size_t first, size_t last) {
     using coord = typename Point::coord;
     int d = Point::dim;
-    size_t n = W.size()/d;
-    auto a = parlay::tabulate(d * n, [&] (size_t i) -> coord {
-	return atof(W[i]);});
+    size_t n = (last - first)/d;
+    auto a = W.parse<coord>(first, first + d * n);
     auto points = parlay::tabulate(n, [&] (size_t i) -> Point {
 	return Point(a.cut(d*i,d*(i + 1)));});
     return points;
@@ -100,14 +100,16 @@ namespace benchIO {
 
   template <class Point>
   parlay::sequence<Point> readPointsFromFile(char const *fname) {
-    parlay::sequence<char> S = readStringFromFile(fname);
-    parlay::sequence<char*> W = stringToWords(S);
     int d = Point::dim;
-    if (W.size() == 0 || W[0] != (d == 2 ? HeaderPoint2d : HeaderPoint3d)) {
+    if (isBinarySeqFile(fname))
+      return readBinarySeqFromFile<Point>(fname, d == 2 ? HeaderPoint2d : HeaderPoint3d);
+    auto F = mmapFile(fname);
+    textWords W(F->start, F->size);
+    if (W.size() == 0 || W.word(0) != (d == 2 ? HeaderPoint2d : HeaderPoint3d)) {
       cout << "readPointsFromFile wrong file type" << endl;
       abort();
     }
-    return parsePoints<Point>(W.cut(1,W.size()));
+    return parsePoints<Point>(W, 1, W.size());
   }
 
   // triangles<point2d> readTrianglesFromFileNodeEle(char const *fname) {
@@ -145,28 +147,29 @@ namespace benchIO {
   template <class pointT>
   triangles<pointT> readTrianglesFromFile(char const *fname, int offset) {
     int d = pointT::dim;
-    parlay::sequence<char> S = readStringFromFile(fname);
-    parlay::sequence<char*> W = stringToWords(S);
-    if (W[0] != HeaderTriangles) {
+    auto F = mmapFile(fname);
+    textWords W(F->start, F->size);
+    if (W.size() < 3 || W.word(0) != HeaderTriangles) {
       cout << "readTrianglesFromFile wrong file type" << endl;
       abort();
     }
 
     int headerSize = 3;
-    size_t n = atol(W[1]);
-    size_t m = atol(W[2]);
+    auto nm = W.parse<long>(1, 3);
+    size_t n = nm[0];
+    size_t m = nm[1];
     if (W.size() != headerSize + 3 * m + d * n) {
       cout << "readTrianglesFromFile inconsistent length" << endl;
       abort();
     }
 
-    auto pts_slice = W.cut(headerSize, headerSize + d * n);
-    auto tri_slice = W.cut(headerSize + d * n, W.size());
-    parlay::sequence<pointT> Pts = parsePoints<pointT>(pts_slice);
+    size_t tri_start = headerSize + d * n;
+    parlay::sequence<pointT> Pts = parsePoints<pointT>(W, headerSize, tri_start);
+    auto T = W.parse<int>(tri_start, W.size());
     auto Tri = parlay::tabulate(m, [&] (size_t i ) -> tri {
-				     return {(int) atol(tri_slice[3*i])-offset,
-					     (int) atol(tri_slice[3*i+1])-offset,
-					     (int) atol(tri_slice[3*i+2])-offset};});
+				     return {T[3*i]-offset,
+					     T[3*i+1]-offset,
+					     T[3*i+2]-offset};});
     return triangles<pointT>(Pts,Tri);
   }
 
@@ -24,6 +24,7 @@
 
 #include <iostream>
 #include <algorithm>
+#include <memory>
 #include "../parlay/parallel.h"
 #include "../parlay/primitives.h"
 
@@ -112,6 +113,16 @@ struct graph {
   parlay::sequence<intV> degrees; // not always used
   size_t n;
   size_t m;
+
+  // The CSR arrays are always accessed through these pointers.  They
+  // point either into offsets and edges, or, for a graph loaded from a
+  // binary file, directly into a memory mapping kept alive by mapping
+  // (in which case offsets and edges are empty).  Copies of a mapped
+  // graph share the mapping.
+  intE* O;
+  intV* E;
+  std::shared_ptr<void> mapping;
+
   size_t numVertices() const {return n;}
   size_t numEdges() const {
     if (degrees.size() == 0) return m;
@@ -123,32 +134,61 @@ struct graph {
     }
   }
 
-  const parlay::sequence<intE>& get_offsets() const {
-    return offsets;
+  auto get_offsets() const {
+    return parlay::make_slice(O, O + n + 1);
   }
 
+  bool is_mapped() const {return mapping != nullptr;}
+
   void addDegrees() {
     degrees = parlay::tabulate(n, [&] (size_t i) -> intV {
-	return offsets[i+1] - offsets[i];});
+	return O[i+1] - O[i];});
   }
 
   MVT operator[] (const size_t i) {
-    return MVT(edges.data() + offsets[i],
+    return MVT(E + O[i],
 	       (degrees.size() == 0)
-	       ? offsets[i+1] - offsets[i] : degrees[i]);}
+	       ? O[i+1] - O[i] : degrees[i]);}
 
   const VT operator[] (const size_t i) const {
-    return VT(edges.data() + offsets[i],
+    return VT(E + O[i],
 	      (degrees.size() == 0)
-	      ? offsets[i+1] - offsets[i] : degrees[i]);
+	      ? O[i+1] - O[i] : degrees[i]);
   }
   
   graph(parlay::sequence<intE> offsets_,
 	parlay::sequence<intV> edges_,
 	size_t n) 
-    : offsets(std::move(offsets_)), edges(std::move(edges_)), n(n), m(edges.size()) {
+    : offsets(std::move(offsets_)), edges(std::move(edges_)), n(n), m(edges.size()),
+      O(offsets.data()), E(edges.data()) {
     if (offsets.size() != n + 1) { std::cout << "error in graph constructor" << std::endl;}
   }
+
+  // wraps CSR arrays living in a memory mapping, without copying
+  graph(intE* O, intV* E, size_t n, size_t m, std::shared_ptr<void> mapping)
+    : n(n), m(m), O(O), E(E), mapping(std::move(mapping)) {}
+
+  graph(graph const &G)
+    : offsets(G.offsets), edges(G.edges), degrees(G.degrees), n(G.n), m(G.m),
+      O(G.O), E(G.E), mapping(G.mapping) {set_pointers();}
+
+  graph(graph &&G)
+    : offsets(std::move(G.offsets)), edges(std::move(G.edges)),
+      degrees(std::move(G.degrees)), n(G.n), m(G.m),
+      O(G.O), E(G.E), mapping(std::move(G.mapping)) {set_pointers();}
+
+  graph& operator=(graph G) {
+    offsets = std::move(G.offsets); edges = std::move(G.edges);
+    degrees = std::move(G.degrees); n = G.n; m = G.m;
+    O = G.O; E = G.E; mapping = std::move(G.mapping);
+    set_pointers();
+    return *this;
+  }
+
+private:
+  void set_pointers() {
+    if (mapping == nullptr) {O = offsets.data(); E = edges.data();}
+  }
 };
 
 // **************************************************************
@@ -173,28 +213,63 @@ struct wghGraph {
   parlay::sequence<Weight> weights;
   size_t n;
   size_t m;
+
+  // as in graph, either point into the sequences above or into a
+  // memory mapping of a binary file
+  intE* O;
+  intV* E;
+  Weight* Wt;
+  std::shared_ptr<void> mapping;
+
   size_t numVertices() const {return n;}
   size_t numEdges() const {return m;}
-  //const parlay::sequence<intV>& get_offsets() const {
-  //  return offsets;
-  //}
-  parlay::sequence<intV> get_offsets() {
-    return offsets;
+  auto get_offsets() const {
+    return parlay::make_slice(O, O + n + 1);
   }
+  bool is_mapped() const {return mapping != nullptr;}
   VT operator[] (const size_t i) {
-    return VT(edges.begin() + offsets[i],
-	      weights.begin() + offsets[i],
-	      offsets[i+1] - offsets[i]);}
+    return VT(E + O[i],
+	      Wt + O[i],
+	      O[i+1] - O[i]);}
 
 wghGraph(parlay::sequence<intE> offsets_,
 	 parlay::sequence<intV> edges_,
 	 parlay::sequence<Weight> weights_,
 	   size_t n) 
     : offsets(std::move(offsets_)), edges(std::move(edges_)),
-      weights(std::move(weights_)), n(n), m(edges.size()) {
+      weights(std::move(weights_)), n(n), m(edges.size()),
+      O(offsets.data()), E(edges.data()), Wt(weights.data()) {
     if (offsets.size() != n + 1 || weights.size() != edges.size()) {
       std::cout << "error in weighted graph constructor" << std::endl;}
   }
+
+  // wraps CSR arrays living in a memory mapping, without copying
+  wghGraph(intE* O, intV* E, Weight* Wt, size_t n, size_t m,
+	   std::shared_ptr<void> mapping)
+    : n(n), m(m), O(O), E(E), Wt(Wt), mapping(std::move(mapping)) {}
+
+  wghGraph(wghGraph const &G)
+    : offsets(G.offsets), edges(G.edges), weights(G.weights), n(G.n), m(G.m),
+      O(G.O), E(G.E), Wt(G.Wt), mapping(G.mapping) {set_pointers();}
+
+  wghGraph(wghGraph &&G)
+    : offsets(std::move(G.offsets)), edges(std::move(G.edges)),
+      weights(std::move(G.weights)), n(G.n), m(G.m),
+      O(G.O), E(G.E), Wt(G.Wt), mapping(std::move(G.mapping)) {set_pointers();}
+
+  wghGraph& operator=(wghGraph G) {
+    offsets = std::move(G.offsets); edges = std::move(G.edges);
+    weights = std::move(G.weights); n = G.n; m = G.m;
+    O = G.O; E = G.E; Wt = G.Wt; mapping = std::move(G.mapping);
+    set_pointers();
+    return *this;
+  }
+
+private:
+  void set_pointers() {
+    if (mapping == nullptr) {
+      O = offsets.data(); E = edges.data(); Wt = weights.data();}
+  }
 };
 
 template <typename intV>
@@ -74,8 +74,187 @@ namespace benchIO {
   string WghEdgeArrayHeader = "WeightedEdgeArray";
   string WghAdjGraphHeader = "WeightedAdjacencyGraph";
 
+  // **************************************************************
+  //    BINARY CSR FORMAT
+  // **************************************************************
+
+  // A binary (little endian) version of the AdjacencyGraph and
+  // WeightedAdjacencyGraph formats.  The file is a header followed by
+  // the n+1 offsets (the last one being m), the m edge targets and,
+  // if weighted, the m weights.  Each section starts at a multiple of
+  // binGraphAlign bytes so it can be used in place from an mmap.
+  constexpr char binGraphMagic[8] = "PBBSCSR";
+  constexpr uint32_t binGraphVersion = 1;
+  constexpr size_t binGraphAlign = 4096;
+
+  struct binGraphHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t weighted;
+    uint64_t n;
+    uint64_t m;
+    uint32_t offsetBytes;   // bytes per offset
+    uint32_t vertexBytes;   // bytes per edge target
+    uint32_t weightBytes;   // bytes per weight, 0 if unweighted
+    uint32_t weightIsFloat; // 1 if weights are floating point
+    uint64_t offsetsStart;  // byte position of each section
+    uint64_t edgesStart;
+    uint64_t weightsStart;
+  };
+
+  inline size_t binGraphRoundUp(size_t x) {
+    return (x + binGraphAlign - 1) / binGraphAlign * binGraphAlign;
+  }
+
+  template <class intV, class intE, class Weight = intV>
+  binGraphHeader makeBinGraphHeader(size_t n, size_t m, bool weighted) {
+    binGraphHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, binGraphMagic, 8);
+    h.version = binGraphVersion;
+    h.weighted = weighted;
+    h.n = n; h.m = m;
+    h.offsetBytes = sizeof(intE);
+    h.vertexBytes = sizeof(intV);
+    h.weightBytes = weighted ? sizeof(Weight) : 0;
+    h.weightIsFloat = weighted && std::is_floating_point<Weight>::value;
+    h.offsetsStart = binGraphRoundUp(sizeof(binGraphHeader));
+    h.edgesStart = binGraphRoundUp(h.offsetsStart + (n + 1) * sizeof(intE));
+    h.weightsStart = weighted ? binGraphRoundUp(h.edgesStart + m * sizeof(intV)) : 0;
+    return h;
+  }
+
+  // true if the file starts with the binary graph magic number
+  bool isBinaryGraphFile(char const *fname) {
+    return fileHasMagic(fname, binGraphMagic);
+  }
+
+  template <class T>
+  parlay::sequence<T> binGraphSection(char const *p, size_t n,
+				      uint32_t bytes, bool isFloat) {
+    return parlay::tabulate(n, [&] (size_t i) -> T {
+	return binaryEntry<T>(p, i, bytes, isFloat, false);});
+  }
+
+  // maps the file and checks the header, aborting on a malformed file
+  std::shared_ptr<mappedFile> mmapBinaryGraph(char const *fname, bool weighted,
+					      binGraphHeader &h) {
+    auto F = mmapFile(fname);
+    if (F->size < sizeof(binGraphHeader)) {
+      cout << "Bad binary graph file: too short" << endl;
+      abort();
+    }
+    memcpy(&h, F->start, sizeof(binGraphHeader));
+    if (memcmp(h.magic, binGraphMagic, 8) != 0) {
+      cout << "Bad binary graph file: missing magic number" << endl;
+      abort();
+    }
+    if (h.version != binGraphVersion) {
+      cout << "Bad binary graph file: unsupported version " << h.version << endl;
+      abort();
+    }
+    if ((bool) h.weighted != weighted) {
+      cout << "Bad binary graph file: expected "
+	   << (weighted ? "weighted" : "unweighted") << " graph" << endl;
+      abort();
+    }
+    size_t end = weighted ? h.weightsStart + h.m * h.weightBytes
+      : h.edgesStart + h.m * h.vertexBytes;
+    if (F->size < end ||
+	h.offsetsStart + (h.n + 1) * h.offsetBytes > h.edgesStart) {
+      cout << "Bad binary graph file: sections do not fit" << endl;
+      abort();
+    }
+    return F;
+  }
+
+  // Loads a binary graph.  If the stored widths match intV and intE
+  // the graph points directly into the mapping, otherwise the
+  // sections are converted into freshly allocated sequences.
+  template <class intV, class intE=intV>
+  graph<intV, intE> readBinaryGraphFromFile(char const *fname) {
+    binGraphHeader h;
+    auto F = mmapBinaryGraph(fname, false, h);
+    size_t n = h.n, m = h.m;
+    char* O = F->start + h.offsetsStart;
+    char* E = F->start + h.edgesStart;
+    if (h.offsetBytes == sizeof(intE) && h.vertexBytes == sizeof(intV))
+      return graph<intV, intE>((intE*) O, (intV*) E, n, m, std::move(F));
+    return graph<intV, intE>(binGraphSection<intE>(O, n + 1, h.offsetBytes, false),
+			     binGraphSection<intV>(E, m, h.vertexBytes, false), n);
+  }
+
+  template <class intV, class Weight, class intE>
+  wghGraph<intV, Weight, intE> readBinaryWghGraphFromFile(char const *fname) {
+    binGraphHeader h;
+    auto F = mmapBinaryGraph(fname, true, h);
+    size_t n = h.n, m = h.m;
+    char* O = F->start + h.offsetsStart;
+    char* E = F->start + h.edgesStart;
+    char* W = F->start + h.weightsStart;
+    bool isFloat = std::is_floating_point<Weight>::value;
+    if (h.offsetBytes == sizeof(intE) && h.vertexBytes == sizeof(intV) &&
+	h.weightBytes == sizeof(Weight) && (bool) h.weightIsFloat == isFloat)
+      return wghGraph<intV, Weight, intE>((intE*) O, (intV*) E, (Weight*) W,
+					  n, m, std::move(F));
+    return wghGraph<intV, Weight, intE>(
+		binGraphSection<intE>(O, n + 1, h.offsetBytes, false),
+		binGraphSection<intV>(E, m, h.vertexBytes, false),
+		binGraphSection<Weight>(W, m, h.weightBytes, h.weightIsFloat), n);
+  }
+
+  // writes the header and sections, padding each to binGraphAlign
+  int writeBinGraphSections(binGraphHeader const &h, char const *fname,
+			    char const *O, char const *E, char const *W) {
+    ofstream file (fname, ios::out | ios::binary);
+    if (!file.is_open()) {
+      std::cout << "Unable to open file: " << fname << std::endl;
+      return 1;
+    }
+    auto pad_to = [&] (size_t pos) {
+      std::string zeros(pos - (size_t) file.tellp(), (char) 0);
+      file.write(zeros.data(), zeros.size());
+    };
+    file.write((char const*) &h, sizeof(binGraphHeader));
+    pad_to(h.offsetsStart);
+    file.write(O, (h.n + 1) * h.offsetBytes);
+    pad_to(h.edgesStart);
+    file.write(E, h.m * h.vertexBytes);
+    if (h.weighted) {
+      pad_to(h.weightsStart);
+      file.write(W, h.m * h.weightBytes);
+    }
+    file.close();
+    return 0;
+  }
+
+  template <class intV, class intE>
+  int writeBinaryGraphToFile(graph<intV, intE> const &G, char const *fname) {
+    if (G.degrees.size() > 0) {
+      graph<intV, intE> GP = packGraph(G);
+      return writeBinaryGraphToFile(GP, fname);
+    }
+    auto h = makeBinGraphHeader<intV, intE>(G.n, G.m, false);
+    return writeBinGraphSections(h, fname, (char const*) G.O,
+				 (char const*) G.E, nullptr);
+  }
+
+  template <class intV, class Weight, class intE>
+  int writeBinaryWghGraphToFile(wghGraph<intV, Weight, intE> const &G,
+				char const *fname) {
+    auto h = makeBinGraphHeader<intV, intE, Weight>(G.n, G.m, true);
+    return writeBinGraphSections(h, fname, (char const*) G.O,
+				 (char const*) G.E, (char const*) G.Wt);
+  }
+
+  // **************************************************************
+  //    TEXT FORMATS
+  // **************************************************************
+
+  // file names ending in ".bin" are written in the binary format
   template <class intV, class intE>
   int writeGraphToFile(graph<intV, intE> const &G, char* fname) {
+    if (isBinaryFileName(fname)) return writeBinaryGraphToFile(G, fname);
     if (G.degrees.size() > 0) {
       graph<intV, intE> GP = packGraph(G);
       return writeGraphToFile(GP, fname);
@@ -88,7 +267,7 @@ namespace benchIO {
     Out[1] = m;
 
     // write offsets to Out[2,..,2+n)
-    parlay::sequence<intE> const &offsets = G.get_offsets();
+    auto offsets = G.get_offsets();
     parlay::parallel_for (0, n, [&] (size_t i) {
     	Out[i+2] = offsets[i];});
 
@@ -105,6 +284,7 @@ namespace benchIO {
 
   template <class intV, class Weight, class intE>
   int writeWghGraphToFile(wghGraph<intV,Weight,intE> G, char* fname) {
+    if (isBinaryFileName(fname)) return writeBinaryWghGraphToFile(G, fname);
     size_t m = G.m;
     size_t n = G.n;
     // weights have to separate since they could be floats
@@ -144,16 +324,22 @@ namespace benchIO {
 
   template <class intV>
   edgeArray<intV> readEdgeArrayFromFile(char* fname) {
-    parlay::sequence<char> S = readStringFromFile(fname);
-    parlay::sequence<char*> W = stringToWords(S);
-    if (W[0] != EdgeArrayHeader) {
-      cout << "Bad input file" << endl;
-      abort();
+    parlay::sequence<edge<intV>> E;
+    if (isBinarySeqFile(fname))
+      E = readBinarySeqFromFile<edge<intV>>(fname, EdgeArrayHeader);
+    else {
+      auto F = mmapFile(fname);
+      textWords W(F->start, F->size);
+      if (W.size() == 0 || W.word(0) != EdgeArrayHeader) {
+	cout << "Bad input file" << endl;
+	abort();
+      }
+      long n = (W.size()-1)/2;
+      E = parlay::sequence<edge<intV>>::uninitialized(n);
+      W.apply(1, 2*n + 1, [&] (size_t i, char const* b, char const* e) {
+	  if (i & 1) E[i/2].u = parseInt<intV>(b, e);
+	  else E[i/2 - 1].v = parseInt<intV>(b, e);});
     }
-    long n = (W.size()-1)/2;
-    auto E = parlay::tabulate(n, [&] (long i) -> edge<intV> {
-	return edge<intV>(atol(W[2*i + 1]),
-			  atol(W[2*i + 2]));});
 
     auto mon = parlay::make_monoid([&] (edge<intV> a, edge<intV> b) {
 	return edge<intV>(std::max(a.u, b.u), std::max(a.v, b.v));},
@@ -167,17 +353,26 @@ namespace benchIO {
   template <class intV, class Weight>
   wghEdgeArray<intV,Weight> readWghEdgeArrayFromFile(char* fname) {
     using WE = wghEdge<intV,Weight>;
-    parlay::sequence<char> S = readStringFromFile(fname);
-    parlay::sequence<char*> W = stringToWords(S);
-    if (W[0] != WghEdgeArrayHeader) {
-      cout << "Bad input file" << endl;
-      abort();
+    parlay::sequence<WE> E;
+    if (isBinarySeqFile(fname))
+      E = readBinarySeqFromFile<WE>(fname, WghEdgeArrayHeader);
+    else {
+      auto F = mmapFile(fname);
+      textWords W(F->start, F->size);
+      if (W.size() == 0 || W.word(0) != WghEdgeArrayHeader) {
+	cout << "Bad input file" << endl;
+	abort();
+      }
+      long n = (W.size()-1)/3;
+      E = parlay::sequence<WE>::uninitialized(n);
+      W.apply(1, 3*n + 1, [&] (size_t i, char const* b, char const* e) {
+	  size_t j = (i - 1) / 3;
+	  switch ((i - 1) % 3) {
+	  case 0: E[j].u = parseInt<intV>(b, e); break;
+	  case 1: E[j].v = parseInt<intV>(b, e); break;
+	  default: E[j].weight = parseNumber<Weight>(b, e);
+	  }});
     }
-    long n = (W.size()-1)/3;
-    auto E = parlay::tabulate(n, [&] (size_t i) -> WE {
-	return WE(atol(W[3*i + 1]),
-		  atol(W[3*i + 2]),
-		  (Weight) atof(W[3*i + 3]));});
 
     auto mon = parlay::make_monoid([&] (WE a, WE b) {
 	return WE(std::max(a.u, b.u), std::max(a.v, b.v), 0);},
@@ -187,125 +382,63 @@ namespace benchIO {
     return wghEdgeArray<intV,Weight>(std::move(E), max<intV>(r.u, r.v) + 1);
   }
 
+  // accepts either the text or the binary format
   template <class intV, class intE=intV>
   graph<intV, intE> readGraphFromFile(char* fname) {
-    auto W = get_tokens(fname);
-    string header(W[0].begin(), W[0].end());
-    if (header != AdjGraphHeader) {
+    if (isBinaryGraphFile(fname))
+      return readBinaryGraphFromFile<intV, intE>(fname);
+    auto F = mmapFile(fname);
+    textWords W(F->start, F->size);
+    if (W.size() < 3 || W.word(0) != AdjGraphHeader) {
       cout << "Bad input file: missing header: " << AdjGraphHeader << endl;
       abort();
     }
 
     // file consists of [type, num_vertices, num_edges, <vertex offsets>, <edges>]
     // in compressed sparse row format
-    long n = parlay::chars_to_long(W[1]);
-    long m = parlay::chars_to_long(W[2]);
+    auto nm = W.parse<long>(1, 3);
+    long n = nm[0];
+    long m = nm[1];
     if (W.size() != n + m + 3) {
       cout << "Bad input file: length = "<< W.size() << " n+m+3 = " << n+m+3 << endl;
       abort(); }
     
     // tags on m at the end (so n+1 total offsets)
-    auto offsets = parlay::tabulate(n+1, [&] (size_t i) -> intE {
-	return (i == n) ? m : parlay::chars_to_long(W[i+3]);});
-    auto edges = parlay::tabulate(m, [&] (size_t i) -> intV {
-	return parlay::chars_to_long(W[n+i+3]);});
+    auto offsets = parlay::sequence<intE>::uninitialized(n+1);
+    W.apply(3, n + 3, [&] (size_t i, char const* b, char const* e) {
+	offsets[i-3] = parseInt<intE>(b, e);});
+    offsets[n] = m;
+    auto edges = W.parse<intV>(n + 3, n + m + 3);
 
     return graph<intV, intE>(std::move(offsets), std::move(edges), n);
   }
 
-  // parlay::sequence<char> mmapStringFromFile(const char *filename) {
-  //   struct stat sb;
-  //   int fd = open(filename, O_RDONLY);
-  //   if (fd == -1) {
-  //     perror("open");
-  //     exit(-1);
-  //   }
-  //   if (fstat(fd, &sb) == -1) {
-  //     perror("fstat");
-  //     exit(-1);
-  //   }
-  //   if (!S_ISREG (sb.st_mode)) {
-  //     perror("not a file\n");
-  //     exit(-1);
-  //   }
-  //   char *p = static_cast<char*>(mmap(0, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0));
-  //   if (p == MAP_FAILED) {
-  //     perror("mmap");
-  //     exit(-1);
-  //   }
-  //   if (close(fd) == -1) {
-  //     perror("close");
-  //     exit(-1);
-  //   }
-  //   size_t n = sb.st_size;
-  //   return parlay::sequence<char>(p, n); // Yikes!
-  // }
-
-  // template <class intV, class intV>
-  // graphC<intV, intV> readGraphCFromFile(char* fname, bool mmap=false) {
-
-  //   parlay::sequence<char*> W;
-  //   if (mmap) {
-  //     cout << "mmapping file" << endl;
-  //     parlay::sequence<char> S = mmapStringFromFile(fname);
-  //     // copy to new sequence
-  //     parlay::sequence<char> bytes = S;
-  //     // and unmap
-  //     if (munmap(S.begin(), S.size()) == -1) {
-  //       perror("munmap");
-  //       exit(-1);
-  //     }
-  //     W = stringToWords(S);
-  //     cout << "mmap'd" << endl;
-  //   } else {
-  //     auto S = readStringFromFile(fname);
-  //     W = stringToWords(S);
-  //   }
-
-  //   if (W[0] != AdjGraphHeader) {
-  //     cout << "Bad input file: missing header: " << AdjGraphHeader << endl;
-  //     abort();
-  //   }
-
-  //   // num vertices, num edges, edge offsets, edge pointers
-  //   long len = W.size() -1;
-  //   long n = atol(W[1]);
-  //   long m = atol(W[2]);
-  //   if (len != n + m + 2) {
-  //     cout << "Bad input file: length = "<<len<< " n+m+2 = " << n+m+2 << endl;
-  //     abort();
-  //   }
-  //   sequence<intV> offsets(n+1, [&] (size_t i) {
-  // 	return (i == n) ? m : atol(W[i+3]);});
-  //   sequence<intV> edges(m, [&] (size_t i) {
-  // 	return atol(W[n+i+3]);});
-
-  //   return graphC<intV,intV>(offsets,edges,n,m);
-  // }
-
   template <class intV, class Weight, class intE>
   wghGraph<intV, Weight, intE> readWghGraphFromFile(char* fname) {
-    parlay::sequence<char> S = readStringFromFile(fname);
-    parlay::sequence<char*> W = stringToWords(S);
-    if (W[0] != WghAdjGraphHeader) {
+    if (isBinaryGraphFile(fname))
+      return readBinaryWghGraphFromFile<intV, Weight, intE>(fname);
+    auto F = mmapFile(fname);
+    textWords W(F->start, F->size);
+    if (W.size() < 3 || W.word(0) != WghAdjGraphHeader) {
       cout << "Bad input file" << endl;
       abort();
     }
 
-    long n = atol(W[1]);
-    long m = atol(W[2]);
+    auto nm = W.parse<long>(1, 3);
+    long n = nm[0];
+    long m = nm[1];
     if (W.size() != n + 2*m + 3) {
       cout << "Bad input file: length = "<< W.size()
 	   << " n + 2*m + 3 = " << n+2*m+3 << endl;
       abort(); }
     
     // tags on m at the end (so n+1 total offsets)
-    auto offsets = parlay::tabulate(n+1, [&] (size_t i) -> intE {
-	return (i == n) ? m : atol(W[i+3]);});
-    auto edges = parlay::tabulate(m, [&] (size_t i) -> intV {
-	return atol(W[n+i+3]);});
-    auto weights = parlay::tabulate(m, [&] (size_t i) -> Weight {
-	return (Weight) atof(W[n+i+3+m]);});
+    auto offsets = parlay::sequence<intE>::uninitialized(n+1);
+    W.apply(3, n + 3, [&] (size_t i, char const* b, char const* e) {
+	offsets[i-3] = parseInt<intE>(b, e);});
+    offsets[n] = m;
+    auto edges = W.parse<intV>(n + 3, n + m + 3);
+    auto weights = W.parse<Weight>(n + m + 3, n + 2*m + 3);
 
     return wghGraph<intV,Weight,intE>(std::move(offsets),
 				      std::move(edges),
@@ -2,6 +2,11 @@ import subprocess
 import sys
 import random
 import os
+import json
+import csv
+import time
+import socket
+import shutil
 
 def onPprocessors(command,p) :
   if "OPENMP" in os.environ:
@@ -11,6 +16,19 @@ def onPprocessors(command,p) :
     return "CILK_NWORKERS="+repr(p)+" " + command
   else:
     return "PARLAY_NUM_THREADS="+repr(p)+" " + command
+
+# memory placement policies, selected with -numa
+numaPolicies = {"none" : "",
+                "interleave" : "numactl --interleave=all ",
+                "localalloc" : "numactl --localalloc "}
+
+def onNumaPolicy(command, policy) :
+  if policy not in numaPolicies :
+    raise NameError("unknown numa policy " + policy + ", use one of "
+                    + ", ".join(numaPolicies.keys()))
+  if len(numaPolicies[policy]) > 0 and shutil.which("numactl") is None :
+    raise NameError("numactl not found, needed for numa policy " + policy)
+  return numaPolicies[policy] + command
   
 def shellGetOutput(str) :
   process = subprocess.Popen(str,shell=True,stdout=subprocess.PIPE,
@@ -26,15 +44,19 @@ def stripFloat(val) :
   trunc = float(int(val*1000))/1000
   return str(trunc).rstrip('0')    
 
-def runSingle(runProgram, options, ifile, procs) :
+# returns the times of the rounds, and any statistics the driver
+# printed (see PBBS_STATS in common/time_loop.h)
+def runSingle(runProgram, options, ifile, procs, numa="none") :
   comString = "./"+runProgram+" "+options+" "+ifile
+  comString = onNumaPolicy(comString, numa)
   if (procs > 0) :
     comString = onPprocessors(comString,procs)
   out = shellGetOutput(comString)
   #print(out)
   try:
     times = [float(str[str.index(':')+2:]) for str in out.split('\n') if str.startswith("Parlay time: ")]
-    return times
+    stats = [json.loads(str[len("PBBS stats: "):]) for str in out.split('\n') if str.startswith("PBBS stats: ")]
+    return (times, stats)
   except (ValueError,IndexError):
     raise NameError(comString+"\n"+out)
 
@@ -44,7 +66,109 @@ def geomean(a) :
     r = r * x
   return r**(1.0/len(a))
 
-def runTest(runProgram, checkProgram, dataDir, test, rounds, procs, noOutput, keepData) :
+def median(a) :
+  b = sorted(a)
+  n = len(b)
+  return b[n//2] if n % 2 == 1 else (b[n//2-1] + b[n//2])/2
+
+# ********************
+# STRUCTURED RESULTS
+# Each test run can be appended as one JSON object per line (-json <file>)
+# and/or one CSV row (-csv <file>).  The JSON records can be compared
+# with:  python3 runTests.py -compare <old> <new> [-threshold <frac>]
+# ********************
+
+def gitRevision() :
+  try :
+    d = os.path.dirname(os.path.abspath(__file__))
+    rev = subprocess.run(["git", "-C", d, "rev-parse", "--short", "HEAD"],
+                         capture_output=True, text=True).stdout.strip()
+    dirty = subprocess.run(["git", "-C", d, "status", "--porcelain", "-uno"],
+                           capture_output=True, text=True).stdout.strip()
+    if len(rev) == 0 : return "unknown"
+    return rev + ("-dirty" if len(dirty) > 0 else "")
+  except OSError :
+    return "unknown"
+
+def numThreads(procs) :
+  if procs > 0 : return procs
+  for var in ["PARLAY_NUM_THREADS", "OMP_NUM_THREADS", "CILK_NWORKERS"] :
+    if var in os.environ : return int(os.environ[var])
+  return detectCPUs()
+
+csvFields = ["benchmark", "program", "input", "options", "threads", "numa", "rounds",
+             "min", "median", "mean", "times", "check", "revision", "host", "date"]
+
+def recordResult(record, jsonFile, csvFile) :
+  if jsonFile :
+    with open(jsonFile, "a") as f :
+      f.write(json.dumps(record) + "\n")
+  if csvFile :
+    newFile = not os.path.exists(csvFile) or os.path.getsize(csvFile) == 0
+    with open(csvFile, "a", newline='') as f :
+      w = csv.writer(f)
+      if newFile : w.writerow(csvFields)
+      w.writerow([" ".join(map(str, record[k])) if k == "times" else record[k]
+                  for k in csvFields])
+
+def readResults(fileName) :
+  with open(fileName) as f :
+    return [json.loads(line) for line in f if len(line.strip()) > 0]
+
+def resultKey(r) :
+  return (r["benchmark"], r["input"], r["options"], r["threads"], r.get("numa", "none"))
+
+# bootstrap confidence interval for the ratio of the median times new/old
+def bootstrapRatio(old, new, samples=2000, confidence=0.95) :
+  rng = random.Random(12345)
+  ratios = sorted(median(rng.choices(new, k=len(new))) /
+                  median(rng.choices(old, k=len(old)))
+                  for i in range(samples))
+  lo = ratios[int((1 - confidence) / 2 * samples)]
+  hi = ratios[min(samples - 1, int((1 + confidence) / 2 * samples))]
+  return (median(new) / median(old), lo, hi)
+
+# fewer rounds than this give no meaningful interval
+minSamples = 3
+
+# Compares two result files test by test.  A test regressed if the whole
+# confidence interval of new/old is above 1 + threshold, and improved if
+# it is below 1 - threshold.  Tests with fewer than minSamples rounds on
+# either side are reported but never flagged.  Returns the number of
+# regressions.
+def compareResults(oldFile, newFile, threshold=0.05) :
+  old = {}
+  for r in readResults(oldFile) : old[resultKey(r)] = r
+  regressions = 0
+  unsure = 0
+  ratios = []
+  for r in readResults(newFile) :
+    k = resultKey(r)
+    if k not in old : continue
+    (ratio, lo, hi) = bootstrapRatio(old[k]["times"], r["times"])
+    ratios.append(ratio)
+    if min(len(old[k]["times"]), len(r["times"])) < minSamples :
+      flag = "not significant (fewer than %d rounds)" % minSamples
+      unsure += 1
+    elif lo > 1 + threshold :
+      flag = "REGRESSION"
+      regressions += 1
+    elif hi < 1 - threshold : flag = "improved"
+    else : flag = ""
+    print("%s : %s : %s : %d threads : numa %s : %s -> %s : ratio %.3f [%.3f, %.3f] %s" %
+          (r["benchmark"], r["input"], r["options"], r["threads"], r.get("numa", "none"),
+           stripFloat(median(old[k]["times"])), stripFloat(median(r["times"])),
+           ratio, lo, hi, flag))
+  if len(ratios) > 0 :
+    print("%d tests compared, geomean ratio = %.3f, %d regressions" %
+          (len(ratios), geomean(ratios), regressions))
+  if unsure > 0 :
+    print("%d tests had fewer than %d rounds, rerun with -r %d or more to compare them" %
+          (unsure, minSamples, minSamples))
+  return regressions
+
+def runTest(runProgram, checkProgram, dataDir, test, rounds, procs, noOutput, keepData,
+            jsonFile=None, csvFile=None, numa="none") :
     random.seed()
     outFile="/tmp/ofile%d_%d" %(random.randint(0, 1000000), random.randint(0, 1000000)) 
     [weight, inputFileNames, runOptions, checkOptions] = test
@@ -54,10 +178,27 @@ def runTest(runProgram, checkProgram, dataDir, test, rounds, procs, noOutput, ke
     if len(dataDir)>0:
       out = shellGetOutput("cd " + dataDir + "; make " + shortInputNames)
     longInputNames = " ".join(dataDir + "/" + name for name in inputFileNames)
+    baseOptions = runOptions
     runOptions = runOptions + " -r " + repr(rounds)
     if (noOutput == 0) :
       runOptions = runOptions + " -o " + outFile
-    times = runSingle(runProgram, runOptions, longInputNames, procs)
+    (times, stats) = runSingle(runProgram, runOptions, longInputNames, procs, numa)
+    record = {"benchmark" : os.path.basename(os.getcwd()),
+              "program" : runProgram,
+              "input" : shortInputNames,
+              "options" : baseOptions,
+              "threads" : numThreads(procs),
+              "numa" : numa,
+              "rounds" : rounds,
+              "times" : times,
+              "min" : min(times),
+              "median" : median(times),
+              "mean" : sum(times)/len(times),
+              "check" : "skipped" if noOutput else "passed",
+              "revision" : gitRevision(),
+              "host" : socket.gethostname(),
+              "date" : time.strftime("%Y-%m-%d %H:%M:%S")}
+    if len(stats) > 0 : record["stats"] = stats
     if (noOutput == 0) :
       checkString = ("./" + checkProgram + " " + checkOptions + " "
                      + longInputNames + " " + outFile)
@@ -66,6 +207,8 @@ def runTest(runProgram, checkProgram, dataDir, test, rounds, procs, noOutput, ke
       nonCommentLines = [s for s in checkOut.split('\n') if not s.startswith(':') and len(s)>0]
       if (len(nonCommentLines) > 0) :
         print("CheckOut:", checkOut)
+        record["check"] = "failed"
+        recordResult(record, jsonFile, csvFile)
         raise NameError(checkString+"\n"+checkOut)
       os.remove(outFile)
     if len(dataDir)>0 and not(keepData):
@@ -75,20 +218,85 @@ def runTest(runProgram, checkProgram, dataDir, test, rounds, procs, noOutput, ke
     outputStr = ""
     if (len(runOptions) > 0) :
       outputStr = " : " + runOptions
+    if (numa != "none") :
+      outputStr = outputStr + " : numa " + numa
     print(shortInputNames + outputStr + " : "
           + ptimes + ", geomean = " + stripFloat(geomean(times)))
+    recordResult(record, jsonFile, csvFile)
     return [weight,times]
     
 def averageTime(times) :
     return sum(times)/len(times)
+
+# ********************
+# SCALING
+# With -scale each test is run on 1, 2, 4, ... threads up to the -p
+# count (or all cores), once for each policy in -numa (comma
+# separated).  Speedup and efficiency are self-relative, i.e. against
+# the same code on one thread with the same policy.  The output is only
+# checked on the last run of each test.
+# ********************
+
+def scalingThreads(maxProcs) :
+  threads = []
+  p = 1
+  while p < maxProcs :
+    threads.append(p)
+    p = 2 * p
+  return threads + [maxProcs]
+
+def scaleTest(runProgram, checkProgram, dataDir, test, rounds, maxProcs, noOutput,
+              keepData, policies, jsonFile, csvFile) :
+  threads = scalingThreads(maxProcs)
+  curves = {}
+  for policy in policies :
+    curves[policy] = []
+    for p in threads :
+      last = (policy == policies[-1]) and (p == threads[-1])
+      [w, times] = runTest(runProgram, checkProgram, dataDir, test, rounds, p,
+                           noOutput or not(last), keepData or not(last),
+                           jsonFile, csvFile, policy)
+      curves[policy].append((p, median(times)))
+  for policy in policies :
+    t1 = curves[policy][0][1]
+    print("  numa %-10s : threads  median   speedup  efficiency" % policy)
+    for (p, t) in curves[policy] :
+      print("  %15s   %7d  %7s  %7.2f  %9.2f" %
+            ("", p, stripFloat(t), t1/t, t1/t/p))
+    # the fewest threads within 5% of the best time
+    bestT = min(t for (p, t) in curves[policy])
+    (bestP, bestT) = [(p, t) for (p, t) in curves[policy] if t <= 1.05 * bestT][0]
+    if bestP < maxProcs :
+      print("  stops scaling at " + repr(bestP) + " threads" +
+            " (peak speedup " + "%.2f" % (t1/bestT) + ")")
+  return curves
+
+def scaleAll(name, runProgram, checkProgram, dataDir, tests, rounds, maxProcs, noOutput,
+             keepData, policies, jsonFile, csvFile) :
+  try:
+    curves = [scaleTest(runProgram, checkProgram, dataDir, test, rounds, maxProcs,
+                        noOutput, keepData, policies, jsonFile, csvFile)
+              for test in tests]
+    for policy in policies :
+      speedups = [geomean([c[policy][0][1]/c[policy][i][1] for c in curves])
+                  for i in range(len(curves[0][policy]))]
+      print(name + " : numa " + policy + " : geomean speedups : " +
+            ", ".join(repr(p) + ":" + "%.2f" % s
+                      for (p, s) in zip(scalingThreads(maxProcs), speedups)))
+    return 0
+  except NameError as x:
+    print("TEST TERMINATED ABNORMALLY:\n["+str(x) + "]")
+    return 1
+  except KeyboardInterrupt:
+    return 1
     
 def timeAll(name, runProgram, checkProgram, dataDir, tests, rounds, procs, noOutput,
-            addToDatabase, problem, keepData) :
+            addToDatabase, problem, keepData, jsonFile=None, csvFile=None, numa="none") :
   totalTime = 0
   totalWeight = 0
   try:
     results = [runTest(runProgram, checkProgram, dataDir, test, rounds, procs,
-                       noOutput, keepData)
+                       noOutput, keepData, jsonFile, csvFile, numa)
                for test in tests]
     meanOfMeans = geomean([geomean(times) for (w,times) in results])
     meanOfMins = geomean([sorted(times)[0] for (w,times) in results])
@@ -132,14 +340,27 @@ def getArgs() :
   processors = int(getArg("-p", 0))
   rounds = int(getArg("-r", 1))
   keep = getOption("-k")
-  return (noOutput, rounds, addToDatabase, processors, keep)
+  jsonFile = getArg("-json", None)
+  csvFile = getArg("-csv", None)
+  scale = getOption("-scale")
+  policies = getArg("-numa", "none").split(",")
+  return (noOutput, rounds, addToDatabase, processors, keep, jsonFile, csvFile,
+          scale, policies)
 
 def timeAllArgs(runProgram, problem, checkProgram, dataDir, tests, keepInputData=False) :
   keepData = keepInputData
-  (noOutput, rounds, addToDatabase, procs, keep) = getArgs()
+  (noOutput, rounds, addToDatabase, procs, keep, jsonFile, csvFile,
+   scale, policies) = getArgs()
   keep = keepInputData or keep
   name = os.path.basename(os.getcwd())
-  timeAll(name, runProgram, checkProgram, dataDir, tests, rounds, procs, noOutput, addToDatabase, problem, keep)
+  if scale :
+    maxProcs = procs if procs > 0 else detectCPUs()
+    scaleAll(name, runProgram, checkProgram, dataDir, tests, rounds, maxProcs, noOutput, keep,
+             policies, jsonFile, csvFile)
+  else :
+    for policy in policies :
+      timeAll(name, runProgram, checkProgram, dataDir, tests, rounds, procs, noOutput, addToDatabase, problem, keep,
+              jsonFile, csvFile, policy)
 
 #
 # Database insertions
@@ -280,3 +501,14 @@ def detectCPUs():
            if ncpus > 0:
                return ncpus
     return 1 # Default    
+
+if __name__ == "__main__" :
+  if getOption("-compare") :
+    i = sys.argv.index("-compare")
+    if len(sys.argv) < i + 3 :
+      print("usage: runTests.py -compare <old.json> <new.json> [-threshold <frac>]")
+      sys.exit(1)
+    threshold = float(getArg("-threshold", 0.05))
+    sys.exit(1 if compareResults(sys.argv[i+1], sys.argv[i+2], threshold) > 0 else 0)
+  else :
+    print("usage: runTests.py -compare <old.json> <new.json> [-threshold <frac>]")
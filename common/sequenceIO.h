@@ -178,12 +178,63 @@ namespace benchIO {
     }
   }
 
+  // Numeric sequences are parsed straight from the mapped file.
+  // Pairs are read as a flat sequence of their components.
+  template <typename T>
+  struct numericElement {
+    static constexpr bool value = std::is_arithmetic<T>::value;
+    static constexpr int width = 1;
+    using component = T;
+    static T make(component const* a) {return a[0];}
+  };
+
+  template <typename A>
+  struct numericElement<pair<A,A>> {
+    static constexpr bool value = std::is_arithmetic<A>::value;
+    static constexpr int width = 2;
+    using component = A;
+    static pair<A,A> make(component const* a) {return pair<A,A>(a[0], a[1]);}
+  };
+
+  // returns the type of a sequence file from its header, reading
+  // only its first word
+  elementType readSequenceType(char const *fileName) {
+    if (isBinarySeqFile(fileName))
+      return elementTypeFromHeader(binarySeqType(fileName));
+    ifstream file (fileName, ios::in | ios::binary);
+    if (!file.is_open()) {
+      std::cout << "Unable to open file: " << fileName << std::endl;
+      abort();
+    }
+    string header;
+    file >> header;
+    return elementTypeFromHeader(header);
+  }
+
   // reads file, tokenizes and then dispatches to specialized parsing function
   template <typename T>
   sequence<T> readSequenceFromFile(char const *fileName) {
-    auto S = get_tokens(fileName);
-    check_header<T>(S[0]);
-    return parseElements<T>(S.cut(1,S.size()));
+    if constexpr (numericElement<T>::value) {
+      T a;
+      if (isBinarySeqFile(fileName))
+	return readBinarySeqFromFile<T>(fileName, seqHeader(dataType(a)));
+      using NE = numericElement<T>;
+      auto F = mmapFile(fileName);
+      textWords W(F->start, F->size);
+      if (W.size() == 0 || W.word(0) != seqHeader(dataType(a))) {
+	cout << "bad header: expected " << seqHeader(dataType(a))
+	     << " got " << W.word(0) << endl;
+	abort();
+      }
+      auto A = W.parse<typename NE::component>(1, W.size());
+      if constexpr (NE::width == 1) return A;
+      else return tabulate(A.size()/NE::width, [&] (size_t i) -> T {
+	  return NE::make(A.data() + NE::width * i);});
+    } else {
+      auto S = get_tokens(fileName);
+      check_header<T>(S);
+      return parseElements<T>(S.cut(1,S.size()));
+    }
   }
   
   template <class T>
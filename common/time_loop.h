@@ -1,5 +1,240 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
 #include "../parlay/internal/get_time.h"
 
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+// **************************************************************
+//    PER ROUND STATISTICS
+// **************************************************************
+
+// Setting the environment variable PBBS_STATS makes time_loop collect,
+// for every timed round, hardware counters (cycles, instructions, last
+// level cache misses, dTLB misses and branch misses), the peak resident
+// set size and the growth of the resident set.  The results are
+// emitted as one JSON object per time_loop call, on a line starting
+// with "PBBS stats: " if PBBS_STATS is "1", or appended to the file it
+// names otherwise.  Counters that cannot be opened (e.g. because of
+// perf_event_paranoid) are reported as null.
+//
+// The counters are opened before main with inherit set, so they also
+// count the worker threads the scheduler starts later on.
+namespace time_loop_stats {
+
+  struct counter {
+    char const* name;
+    uint32_t type;
+    uint64_t config;
+    int fd;
+  };
+
+  struct snapshot {
+    double time;
+    std::vector<long> counts;   // -1 if the counter is not available
+    long rss;
+  };
+
+  struct phase {
+    std::string name;
+    snapshot start, end;
+  };
+
+  struct round {
+    snapshot start, end;
+    long peak_rss;
+    std::vector<phase> phases;
+  };
+
+  struct recorder {
+    bool enabled = false;
+    std::string dest;
+    std::vector<counter> counters;
+    std::vector<round> rounds;
+    bool in_round = false;
+    parlay::internal::timer clock;
+
+    recorder() {
+      char const* s = getenv("PBBS_STATS");
+      if (s == nullptr || *s == 0) return;
+      enabled = true;
+      dest = s;
+#ifdef __linux__
+      auto cache = [] (uint64_t c, uint64_t op, uint64_t res) {
+	return c | (op << 8) | (res << 16);};
+      counters = {
+	{"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1},
+	{"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, -1},
+	{"llc_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, -1},
+	{"dtlb_misses", PERF_TYPE_HW_CACHE,
+	 cache(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ,
+	       PERF_COUNT_HW_CACHE_RESULT_MISS), -1},
+	{"branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, -1}};
+      for (auto &c : counters) {
+	perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = c.type;
+	attr.config = c.config;
+	attr.inherit = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	c.fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+      }
+#endif
+    }
+
+    ~recorder() {
+#ifdef __linux__
+      for (auto &c : counters) if (c.fd >= 0) close(c.fd);
+#endif
+    }
+
+    // counts are scaled up if the kernel had to multiplex the counters
+    long read_counter(counter const &c) {
+#ifdef __linux__
+      uint64_t v[3];
+      if (c.fd < 0 || read(c.fd, v, sizeof(v)) != sizeof(v)) return -1;
+      if (v[2] == 0) return 0;
+      return (long) ((double) v[0] * v[1] / v[2]);
+#else
+      return -1;
+#endif
+    }
+
+    // reads a "kB" field of /proc/self/status, in bytes
+    long status_field(char const* field) {
+      std::ifstream f("/proc/self/status");
+      std::string line;
+      size_t l = strlen(field);
+      while (std::getline(f, line))
+	if (line.compare(0, l, field) == 0)
+	  return atol(line.c_str() + l + 1) * 1024;
+      return -1;
+    }
+
+    // resets the peak resident set size (VmHWM) to the current one
+    void reset_peak_rss() {
+      std::ofstream f("/proc/self/clear_refs");
+      if (f.is_open()) f << "5";
+    }
+
+    snapshot take() {
+      snapshot s;
+      for (auto &c : counters) s.counts.push_back(read_counter(c));
+      s.rss = status_field("VmRSS:");
+      s.time = clock.total_time();
+      return s;
+    }
+
+    void start_round() {
+      if (!enabled) return;
+      reset_peak_rss();
+      rounds.push_back(round());
+      rounds.back().start = take();
+      in_round = true;
+    }
+
+    void end_round() {
+      if (!enabled) return;
+      in_round = false;
+      round &r = rounds.back();
+      r.end = take();
+      r.peak_rss = status_field("VmHWM:");
+      if (!r.phases.empty()) r.phases.back().end = r.end;
+    }
+
+    void start_phase(std::string const &name) {
+      if (!enabled || !in_round) return;
+      round &r = rounds.back();
+      snapshot s = take();
+      if (!r.phases.empty()) r.phases.back().end = s;
+      r.phases.push_back(phase{name, s, s});
+    }
+
+    void add_deltas(std::ostream &os, snapshot const &a, snapshot const &b) {
+      os << "\"time\": " << b.time - a.time;
+      for (size_t i = 0; i < counters.size(); i++) {
+	os << ", \"" << counters[i].name << "\": ";
+	if (a.counts[i] < 0 || b.counts[i] < 0) os << "null";
+	else os << b.counts[i] - a.counts[i];
+      }
+    }
+
+    // writes s as a JSON string, escaping quotes, backslashes and
+    // control characters
+    static void add_string(std::ostream &os, std::string const &s) {
+      os << '"';
+      for (char c : s) {
+	if (c == '"' || c == '\\') os << '\\' << c;
+	else if ((unsigned char) c < 0x20) {
+	  char buf[8];
+	  snprintf(buf, sizeof(buf), "\\u%04x", (unsigned char) c);
+	  os << buf;
+	} else os << c;
+      }
+      os << '"';
+    }
+
+    // emits the rounds recorded since the last report and clears them
+    void report() {
+      if (!enabled || rounds.empty()) return;
+      std::ostringstream os;
+      os.precision(6);
+      os << "{\"rounds\": [";
+      for (size_t i = 0; i < rounds.size(); i++) {
+	round const &r = rounds[i];
+	os << (i ? ", " : "") << "{";
+	add_deltas(os, r.start, r.end);
+	os << ", \"peak_rss\": " << r.peak_rss
+	   << ", \"rss_growth\": " << r.end.rss - r.start.rss;
+	if (!r.phases.empty()) {
+	  os << ", \"phases\": [";
+	  for (size_t j = 0; j < r.phases.size(); j++) {
+	    os << (j ? ", " : "") << "{\"name\": ";
+	    add_string(os, r.phases[j].name);
+	    os << ", ";
+	    add_deltas(os, r.phases[j].start, r.phases[j].end);
+	    os << "}";
+	  }
+	  os << "]";
+	}
+	os << "}";
+      }
+      os << "]}";
+      rounds.clear();
+      if (dest == "1") std::cout << "PBBS stats: " << os.str() << std::endl;
+      else {
+	std::ofstream f(dest, std::ios::app);
+	f << os.str() << std::endl;
+      }
+    }
+  };
+
+  inline recorder stats;
+}
+
+// Marks the start of a named phase within the current timed round, so
+// the statistics of the round are also broken down by phase.  Does
+// nothing unless PBBS_STATS is set.
+inline void time_loop_phase(std::string const &name) {
+  time_loop_stats::stats.start_phase(name);
+}
+
 template<class F, class G, class H>
 void time_loop(int rounds, double delay, F initf, G runf, H endf) {
   parlay::internal::timer t;
@@ -7,12 +242,15 @@ void time_loop(int rounds, double delay, F initf, G runf, H endf) {
   // will skip if delay is zero
   while (t.total_time() < delay) {
     initf(); runf(); endf();
-  } 
+  }
   for (int i=0; i < rounds; i++) {
     initf();
+    time_loop_stats::stats.start_round();
     t.start();
     runf();
     t.next("");
+    time_loop_stats::stats.end_round();
     endf();
   }
+  time_loop_stats::stats.report();
 }